@@ -0,0 +1,257 @@
+/* A persistent head-to-head archive: every opponent each player has ever had,
+ * across every event and roster, in one file. It's mmap'd rather than read in,
+ * so only the pages a lookup actually touches are ever loaded, and a lookup is
+ * just two binary searches.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "archive.h"
+#include "files.h"
+#include "util.h"
+
+char *archiveFile;
+
+static ArchiveHeader *header;
+static ArchiveEntry *entries;
+static int32_t *opponents;
+static size_t mappedSize;
+
+static ArchiveEntry *findEntry(int id);
+static void checkEntry(ArchiveEntry *entry);
+static int writeAll(FILE *file, const void *data, size_t size, size_t count);
+static void syncDirectory(const char *path);
+static int compareGames(const void *game1, const void *game2);
+
+
+// maps the archive into memory. A missing archive is the same as an empty one
+void openArchive()
+{
+	struct stat info;
+	int file = open(archiveFile, O_RDONLY);
+
+	if (file == -1)
+		return;
+	if (fstat(file, &info) == -1 || info.st_size == 0) {
+		close(file);
+		return;
+	}
+
+	mappedSize = info.st_size;
+	header = mmap(NULL, mappedSize, PROT_READ, MAP_SHARED, file, 0);
+	close(file);
+	// the counts are checked against what's left of the file one at a time,
+	// so a corrupt one can't overflow the sum
+	if (header == MAP_FAILED || mappedSize < sizeof(ArchiveHeader) || memcmp(header->magic, ARCHIVE_MAGIC, 4) != 0
+			|| header->numPlayers > (mappedSize - sizeof(ArchiveHeader)) / sizeof(ArchiveEntry)
+			|| header->numOpponents > (mappedSize - sizeof(ArchiveHeader)
+				- header->numPlayers * sizeof(ArchiveEntry)) / sizeof(int32_t)) {
+		fprintf(stderr, "ERROR: \"%s\" isn't a head-to-head archive\n", archiveFile);
+		exit(1);
+	}
+
+	entries = (ArchiveEntry *)(header + 1);
+	opponents = (int32_t *)(entries + header->numPlayers);
+}
+
+
+void closeArchive()
+{
+	if (header != NULL)
+		munmap(header, mappedSize);
+	header = NULL;
+}
+
+
+int archiveHasFought(int id1, int id2)
+{
+	ArchiveEntry *entry = findEntry(id1);
+	int32_t *played;
+	uint32_t low = 0, high;
+
+	if (entry == NULL)
+		return 0;
+
+	checkEntry(entry);
+	played = opponents + entry->offset;
+	high = entry->numOpponents;
+	while (low < high) {
+		uint32_t middle = low + (high - low) / 2;
+		if (played[middle] < id2)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+	return low < entry->numOpponents && played[low] == id2;
+}
+
+
+static ArchiveEntry *findEntry(int id)
+{
+	uint32_t low = 0, high;
+
+	if (header == NULL)
+		return NULL;
+
+	high = header->numPlayers;
+	while (low < high) {
+		uint32_t middle = low + (high - low) / 2;
+		if (entries[middle].id < id)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+	return low < header->numPlayers && entries[low].id == id ? &entries[low] : NULL;
+}
+
+
+// the entries are only checked as they're used, so opening the archive doesn't
+// have to read every one of them in
+static void checkEntry(ArchiveEntry *entry)
+{
+	if (entry->offset > header->numOpponents || entry->numOpponents > header->numOpponents - entry->offset) {
+		fprintf(stderr, "ERROR: \"%s\" isn't a head-to-head archive\n", archiveFile);
+		exit(1);
+	}
+}
+
+
+/* Merges everyone's opponents from the roster (including this round's) into
+ * the archive. The new archive is written next to the old one and synced to
+ * disk, then renamed over it, so a crash never leaves a half-written archive
+ * behind. If any of it can't be written, the old archive's left as it was.
+ */
+void updateArchive()
+{
+	// every game in the roster, both ways round, as (player, opponent)
+	int32_t (*games)[2];
+	int numGames = 0, game = 0;
+	uint32_t numOld = header == NULL ? 0 : header->numPlayers, entry = 0;
+	ArchiveHeader newHeader;
+	ArchiveEntry *newEntries;
+	int32_t *newOpponents;
+	char *tempFile = malloc(strlen(archiveFile) + 5);
+	FILE *archive;
+	int isWritten;
+
+	for (int i = 0; i < totalPlayers; i++)
+		numGames += 2 * players[i].prevPlayedNum;
+	games = malloc((numGames + 1) * sizeof(*games));
+	numGames = 0;
+	for (int i = 0; i < totalPlayers; i++)
+		for (int j = 0; j < players[i].prevPlayedNum; j++) {
+			games[numGames][0] = players[i].id;
+			games[numGames++][1] = players[i].prevPlayed[j];
+			games[numGames][0] = players[i].prevPlayed[j];
+			games[numGames++][1] = players[i].id;
+		}
+	qsort(games, numGames, sizeof(*games), compareGames);
+
+	newEntries = malloc((numOld + numGames + 1) * sizeof(ArchiveEntry));
+	newOpponents = malloc(((header == NULL ? 0 : header->numOpponents) + numGames + 1) * sizeof(int32_t));
+	newHeader.numPlayers = 0;
+	newHeader.numOpponents = 0;
+
+	// both the archive and the games are sorted by ID, so they can be merged
+	// one player at a time
+	while (entry < numOld || game < numGames) {
+		int32_t id, *old = NULL, last = 0;
+		uint32_t oldCount = 0, k = 0;
+		ArchiveEntry *newEntry = &newEntries[newHeader.numPlayers++];
+
+		if (game == numGames || (entry < numOld && entries[entry].id <= games[game][0]))
+			id = entries[entry].id;
+		else
+			id = games[game][0];
+		if (entry < numOld && entries[entry].id == id) {
+			checkEntry(&entries[entry]);
+			old = opponents + entries[entry].offset;
+			oldCount = entries[entry++].numOpponents;
+		}
+
+		newEntry->id = id;
+		newEntry->offset = newHeader.numOpponents;
+		newEntry->numOpponents = 0;
+		while (k < oldCount || (game < numGames && games[game][0] == id)) {
+			int32_t next;
+			if (game == numGames || games[game][0] != id || (k < oldCount && old[k] <= games[game][1]))
+				next = old[k++];
+			else
+				next = games[game++][1];
+			// players can meet more than once, but only need archiving once
+			if (newEntry->numOpponents != 0 && next == last)
+				continue;
+			newOpponents[newHeader.numOpponents++] = next;
+			newEntry->numOpponents++;
+			last = next;
+		}
+	}
+
+	sprintf(tempFile, "%s.tmp", archiveFile);
+	archive = fopen(tempFile, "wb");
+	if (archive == NULL) {
+		fprintf(stderr, "ERROR: Couldn't write \"%s\"\n", tempFile);
+		exit(1);
+	}
+	memcpy(newHeader.magic, ARCHIVE_MAGIC, 4);
+	isWritten = writeAll(archive, &newHeader, sizeof(newHeader), 1)
+		&& writeAll(archive, newEntries, sizeof(ArchiveEntry), newHeader.numPlayers)
+		&& writeAll(archive, newOpponents, sizeof(int32_t), newHeader.numOpponents)
+		&& fflush(archive) == 0 && fsync(fileno(archive)) == 0;
+	if (fclose(archive) != 0)
+		isWritten = 0;
+
+	if (!isWritten) {
+		fprintf(stderr, "ERROR: Couldn't write \"%s\", so \"%s\" wasn't updated\n", tempFile, archiveFile);
+		remove(tempFile);
+	} else {
+		// the old archive has to be unmapped before it's replaced
+		closeArchive();
+		if (rename(tempFile, archiveFile) != 0)
+			fprintf(stderr, "ERROR: Couldn't replace \"%s\"\n", archiveFile);
+		else
+			syncDirectory(archiveFile);
+	}
+
+	free(games);
+	free(newEntries);
+	free(newOpponents);
+	free(tempFile);
+}
+
+
+// returns 1 if all of it was written; 0 otherwise
+static int writeAll(FILE *file, const void *data, size_t size, size_t count)
+{
+	return fwrite(data, size, count, file) == count;
+}
+
+
+// the rename only lasts through a crash once the directory it's in is synced
+static void syncDirectory(const char *path)
+{
+	const char *slash = strrchr(path, '/');
+	char *directory = slash == NULL ? strdup(".") : strndup(path, slash == path ? 1 : slash - path);
+	int file = open(directory, O_RDONLY);
+
+	if (file == -1 || fsync(file) != 0)
+		fprintf(stderr, "ERROR: Couldn't sync \"%s\"\n", directory);
+	if (file != -1)
+		close(file);
+	free(directory);
+}
+
+
+static int compareGames(const void *game1, const void *game2)
+{
+	const int32_t *g1 = game1, *g2 = game2;
+
+	if (g1[0] != g2[0])
+		return g1[0] < g2[0] ? -1 : 1;
+	return g1[1] < g2[1] ? -1 : g1[1] > g2[1];
+}
@@ -0,0 +1,34 @@
+#include <stdint.h>
+
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+#define ARCHIVE_MAGIC         "H2H1"
+
+/* The archive file is laid out as:
+ * - an ArchiveHeader
+ * - an ArchiveEntry for each player, sorted by ID
+ * - every player's opponents as int32_t's, each player's sorted and in the
+ *   same order as the entries
+ */
+typedef struct {
+	char magic[4];
+	uint32_t numPlayers;
+	uint64_t numOpponents;
+} ArchiveHeader;
+
+typedef struct {
+	int32_t id;
+	uint32_t numOpponents;
+	// where the player's opponents start, counted in opponents
+	uint64_t offset;
+} ArchiveEntry;
+
+void openArchive(void);
+void closeArchive(void);
+int archiveHasFought(int id1, int id2);
+void updateArchive(void);
+
+extern char *archiveFile;
+
+#endif
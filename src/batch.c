@@ -0,0 +1,363 @@
+/* Batch mode: every section of an event is paired in one go. The sections are
+ * either every roster in a directory or the rosters listed in a manifest, one
+ * per line. Each one is paired on a thread of its own, with its own roster, so
+ * the whole lot takes about as long as the biggest section. Each section gets
+ * its own pairings and updated roster, and a summary of them all is printed at
+ * the end.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "batch.h"
+#include "files.h"
+#include "pairing.h"
+#include "pool.h"
+#include "output.h"
+#include "util.h"
+
+// the directory or manifest of rosters. NULL means there's only one roster
+char *batchPath;
+// where each section's files go. NULL puts them next to its roster
+char *outputDir;
+
+typedef struct {
+	char *rosterFile, *pairingFile, *updatedFile;
+	// the roster's file name, without its directory or extension
+	char *name;
+	long fileSize;
+	int totalPlayers, unpaired;
+	double ms;
+	int isFailed;
+} Section;
+
+static int findSections(Section **sections);
+static void addSection(Section **sections, int *numSections, char *rosterFile);
+static void pairSection(void *arg);
+static void printSummary(Section *sections, int numSections, double ms);
+static int compareNames(const void *name1, const void *name2);
+static int compareSizes(const void *task1, const void *task2);
+static double milliseconds(struct timespec start, struct timespec end);
+
+
+void runBatch()
+{
+	Section *sections;
+	int numSections = findSections(&sections);
+	Task *tasks = malloc((numSections + 1) * sizeof(Task));
+	int threads = numThreads;
+	struct timespec start, end;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int i = 0; i < numSections; i++) {
+		tasks[i].run = pairSection;
+		tasks[i].arg = &sections[i];
+	}
+	// the biggest sections go first, so a big one isn't left until the end
+	qsort(tasks, numSections, sizeof(Task), compareSizes);
+
+	// the threads are shared out between the sections, not within them
+	numThreads = 1;
+	runTasks(tasks, numSections, threads);
+	numThreads = threads;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	printSummary(sections, numSections, milliseconds(start, end));
+
+	for (int i = 0; i < numSections; i++) {
+		free(sections[i].rosterFile);
+		free(sections[i].pairingFile);
+		free(sections[i].updatedFile);
+		free(sections[i].name);
+	}
+	free(sections);
+	free(tasks);
+}
+
+
+// returns the number of sections, in the order they're listed (or in
+// alphabetical order, for a directory)
+static int findSections(Section **sections)
+{
+	struct stat info;
+	int numSections = 0;
+
+	*sections = NULL;
+	if (stat(batchPath, &info) == -1) {
+		fprintf(stderr, "ERROR: Couldn't open \"%s\"\n", batchPath);
+		exit(1);
+	}
+
+	if (S_ISDIR(info.st_mode)) {
+		DIR *directory = opendir(batchPath);
+		struct dirent *entry;
+		char **names = NULL;
+		int numNames = 0;
+
+		while (directory != NULL && (entry = readdir(directory)) != NULL) {
+			int length = strlen(entry->d_name);
+			// updated rosters from a previous run aren't sections
+			if (length < 4 || strcmp(entry->d_name + length - 4, ".txt")
+					|| (length >= 8 && !strcmp(entry->d_name + length - 8, ".new.txt")))
+				continue;
+			names = realloc(names, (numNames + 1) * sizeof(char *));
+			names[numNames] = malloc(strlen(batchPath) + length + 2);
+			sprintf(names[numNames++], "%s/%s", batchPath, entry->d_name);
+		}
+		if (directory != NULL)
+			closedir(directory);
+
+		qsort(names, numNames, sizeof(char *), compareNames);
+		for (int i = 0; i < numNames; i++)
+			addSection(sections, &numSections, names[i]);
+		free(names);
+	} else {
+		FILE *manifest = fopen(batchPath, "r");
+		char line[MAXLINE];
+
+		while (manifest != NULL && fgets(line, sizeof(line), manifest) != NULL) {
+			char *end = line + strlen(line);
+			char *start = line;
+
+			while (end > line && (end[-1] == '\n' || end[-1] == '\r' || end[-1] == ' ' || end[-1] == '\t'))
+				*--end = '\0';
+			while (*start == ' ' || *start == '\t')
+				start++;
+			// blank lines and comments
+			if (*start == '\0' || *start == '#')
+				continue;
+			addSection(sections, &numSections, strdup(start));
+		}
+		if (manifest != NULL)
+			fclose(manifest);
+	}
+
+	return numSections;
+}
+
+
+static void addSection(Section **sections, int *numSections, char *rosterFile)
+{
+	Section *section;
+	struct stat info;
+	char *fileName = strrchr(rosterFile, '/');
+	char *extension;
+	char *directory = outputDir;
+	int directoryLength;
+	const char *pairingExtension = outputFormat == FORMAT_CSV ? ".pairings.csv"
+		: outputFormat == FORMAT_JSON ? ".pairings.json" : ".pairings";
+
+	*sections = realloc(*sections, (*numSections + 1) * sizeof(Section));
+	section = &(*sections)[(*numSections)++];
+
+	fileName = fileName == NULL ? rosterFile : fileName + 1;
+	section->rosterFile = rosterFile;
+	section->name = strdup(fileName);
+	extension = strrchr(section->name, '.');
+	if (extension != NULL && extension != section->name)
+		*extension = '\0';
+	section->fileSize = stat(rosterFile, &info) == 0 ? info.st_size : 0;
+
+	// the section's own files go next to its roster, unless told otherwise
+	if (directory == NULL) {
+		directory = rosterFile;
+		directoryLength = fileName == rosterFile ? 0 : fileName - rosterFile - 1;
+	} else {
+		directoryLength = strlen(directory);
+	}
+	if (directoryLength == 0) {
+		directory = ".";
+		directoryLength = 1;
+	}
+	section->pairingFile = malloc(directoryLength + strlen(section->name) + strlen(pairingExtension) + 2);
+	sprintf(section->pairingFile, "%.*s/%s%s", directoryLength, directory, section->name, pairingExtension);
+	section->updatedFile = malloc(directoryLength + strlen(section->name) + 10);
+	sprintf(section->updatedFile, "%.*s/%s.new.txt", directoryLength, directory, section->name);
+
+	section->totalPlayers = section->unpaired = 0;
+	section->ms = 0;
+	section->isFailed = 0;
+}
+
+
+// pairs one section, from start to finish, on this thread's own roster
+static void pairSection(void *arg)
+{
+	Section *section = arg;
+	struct timespec start, end;
+	jmp_buf handler;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	outputStream = fopen(section->pairingFile, "w");
+	if (outputStream == NULL) {
+		fprintf(stderr, "ERROR: Couldn't write \"%s\"\n", section->pairingFile);
+		section->isFailed = 1;
+		return;
+	}
+
+	players = NULL;
+	totalPlayers = longestName = longestPlayerID = 0;
+	playerFile = section->rosterFile;
+	updatedPlayerFile = section->updatedFile;
+
+	// a roster that can't be read only fails its own section
+	if (setjmp(handler) != 0) {
+		errorHandler = NULL;
+		if (fp != NULL)
+			fclose(fp);
+		freePlayerList();
+		fclose(outputStream);
+		outputStream = NULL;
+		remove(section->pairingFile);
+		fprintf(stderr, "ERROR: Couldn't read \"%s\", so it wasn't paired\n", section->rosterFile);
+		section->isFailed = 1;
+		return;
+	}
+	errorHandler = &handler;
+	readInPlayers();
+	errorHandler = NULL;
+	sortPlayers();
+	publishPairings();
+	section->totalPlayers = totalPlayers;
+	section->unpaired = unpairedPlayers;
+	freePlayerList();
+
+	fclose(outputStream);
+	outputStream = NULL;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	section->ms = milliseconds(start, end);
+}
+
+
+static void printSummary(Section *sections, int numSections, double ms)
+{
+	int totalPlayers = 0, totalUnpaired = 0;
+	char number[32];
+
+	beginOutput();
+	if (outputFormat == FORMAT_TEXT)
+		emitString("Section                   Players  Pairings  Unpaired         ms\n");
+	else if (outputFormat == FORMAT_CSV)
+		emitString("section,players,pairings,unpaired,ms\n");
+	else
+		emitString("\"sections\":[");
+
+	for (int i = 0; i < numSections; i++) {
+		Section *section = &sections[i];
+		int pairings = (section->totalPlayers - section->unpaired) / 2;
+
+		totalPlayers += section->totalPlayers;
+		totalUnpaired += section->unpaired;
+		snprintf(number, sizeof(number), "%.2f", section->ms);
+
+		switch (outputFormat) {
+			case FORMAT_TEXT:
+				emitPadded(section->name, -24);
+				emitPadded("", 10 - numLength(section->totalPlayers));
+				emitInt(section->totalPlayers);
+				emitPadded("", 10 - numLength(pairings));
+				emitInt(pairings);
+				emitPadded("", 10 - numLength(section->unpaired));
+				emitInt(section->unpaired);
+				emitPadded(section->isFailed ? "failed" : number, 11);
+				emitChar('\n');
+				break;
+
+			case FORMAT_CSV:
+				emitString(section->name);
+				emitChar(',');
+				emitInt(section->totalPlayers);
+				emitChar(',');
+				emitInt(pairings);
+				emitChar(',');
+				emitInt(section->unpaired);
+				emitChar(',');
+				emitString(section->isFailed ? "" : number);
+				emitChar('\n');
+				break;
+
+			case FORMAT_JSON:
+				if (i != 0)
+					emitChar(',');
+				emitString("{\"name\":\"");
+				// unlike players' names, file names can have anything in them
+				emitJSONString(section->name);
+				emitString("\",\"players\":");
+				emitInt(section->totalPlayers);
+				emitString(",\"pairings\":");
+				emitInt(pairings);
+				emitString(",\"unpaired\":");
+				emitInt(section->unpaired);
+				emitString(",\"ms\":");
+				emitString(section->isFailed ? "null" : number);
+				emitChar('}');
+				break;
+		}
+	}
+
+	snprintf(number, sizeof(number), "%.2f", ms);
+	switch (outputFormat) {
+		case FORMAT_TEXT:
+			emitPadded("Total", -24);
+			emitPadded("", 10 - numLength(totalPlayers));
+			emitInt(totalPlayers);
+			emitPadded("", 10 - numLength((totalPlayers - totalUnpaired) / 2));
+			emitInt((totalPlayers - totalUnpaired) / 2);
+			emitPadded("", 10 - numLength(totalUnpaired));
+			emitInt(totalUnpaired);
+			emitPadded(number, 11);
+			emitChar('\n');
+			break;
+
+		case FORMAT_CSV:
+			emitString("total,");
+			emitInt(totalPlayers);
+			emitChar(',');
+			emitInt((totalPlayers - totalUnpaired) / 2);
+			emitChar(',');
+			emitInt(totalUnpaired);
+			emitChar(',');
+			emitString(number);
+			emitChar('\n');
+			break;
+
+		case FORMAT_JSON:
+			emitString("],\"total\":{\"players\":");
+			emitInt(totalPlayers);
+			emitString(",\"pairings\":");
+			emitInt((totalPlayers - totalUnpaired) / 2);
+			emitString(",\"unpaired\":");
+			emitInt(totalUnpaired);
+			emitString(",\"ms\":");
+			emitString(number);
+			emitChar('}');
+			break;
+	}
+	endOutput();
+}
+
+
+static int compareNames(const void *name1, const void *name2)
+{
+	return strcmp(*(char *const *)name1, *(char *const *)name2);
+}
+
+
+// sorts the biggest sections first
+static int compareSizes(const void *task1, const void *task2)
+{
+	const Section *section1 = ((const Task *)task1)->arg, *section2 = ((const Task *)task2)->arg;
+
+	if (section1->fileSize != section2->fileSize)
+		return section1->fileSize < section2->fileSize ? 1 : -1;
+	return section1 < section2 ? -1 : 1;
+}
+
+
+static double milliseconds(struct timespec start, struct timespec end)
+{
+	return (end.tv_sec - start.tv_sec) * 1000.0 + (end.tv_nsec - start.tv_nsec) / 1000000.0;
+}
@@ -0,0 +1,8 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+void runBatch(void);
+
+extern char *batchPath, *outputDir;
+
+#endif
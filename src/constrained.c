@@ -0,0 +1,272 @@
+/* Most-constrained-first pairing. The players greedy pairing strands are the
+ * ones with only a few possible opponents, who get reached after those
+ * opponents have already been taken. So instead, whoever has the fewest
+ * opponents left is paired first, with whichever of those opponents has the
+ * fewest left themselves.
+ *
+ * Only pairs who are both free for long enough are ever chosen, so once
+ * they all have been, they're given their times in the order of the roster,
+ * as greedy pairing's are. Staggering a match from the one before it can't
+ * stop it from going ahead here, though: if there isn't room to, it keeps its
+ * earliest time instead.
+ *
+ * Everyone's possible opponents are worked out once, up front, on as many
+ * threads as there are. How many each player has left is kept in an indexed
+ * heap, so every time a pairing takes two players out, each of their possible
+ * opponents moves up the heap in O(log n), and the whole thing is O(E log n)
+ * on the possible pairings.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "files.h"
+#include "util.h"
+#include "pairing.h"
+#include "pool.h"
+#include "constrained.h"
+#include "trace.h"
+
+// how many rows of possible opponents each thread is given at a time
+#define OPTIONS_CHUNK         256
+
+typedef struct {
+	// players, as a binary heap with the fewest options at the top. Ties go
+	// to whoever's first in the roster
+	int *items;
+	int size;
+	// where each player is in items, or -1 if they aren't in the heap
+	int *position;
+	// how many unpaired players each player could still be paired with
+	int *options;
+} Heap;
+
+// finds the possible opponents after each player from first up to last
+typedef struct {
+	Player *roster;
+	int numPlayers;
+	int first, last;
+	// every possible pairing, as the pair of players, first player first
+	int *pairs;
+	int numPairs;
+} OptionsTask;
+
+static void findOptions(int **start, int **opponents);
+static void findRows(void *arg);
+static void takeOut(Heap *heap, int *start, int *opponents, int player);
+static int isBefore(Heap *heap, int player1, int player2);
+static void removeHeap(Heap *heap, int player);
+static void siftUp(Heap *heap, int index);
+static void siftDown(Heap *heap, int index);
+static void swapItems(Heap *heap, int index1, int index2);
+
+
+Pairing *pairConstrained(int *size)
+{
+	TRACE_SCOPE("pairConstrained");
+	Pairing *pairings = malloc((totalPlayers / 2 + 1) * sizeof(Pairing));
+	// player i's possible opponents are opponents[start[i]] up to opponents[start[i + 1]]
+	int *start, *opponents;
+	// the index of each player's opponent, or -1 if they're unpaired
+	int *mate = malloc((totalPlayers + 1) * sizeof(int));
+	Heap heap;
+
+	findOptions(&start, &opponents);
+
+	heap.items = malloc((totalPlayers + 1) * sizeof(int));
+	heap.position = malloc((totalPlayers + 1) * sizeof(int));
+	heap.options = malloc((totalPlayers + 1) * sizeof(int));
+	heap.size = 0;
+	// anyone who can't play anybody never goes in
+	for (int i = 0; i < totalPlayers; i++) {
+		mate[i] = -1;
+		heap.options[i] = start[i + 1] - start[i];
+		heap.position[i] = -1;
+		if (heap.options[i] > 0) {
+			heap.items[heap.size] = i;
+			heap.position[i] = heap.size++;
+			siftUp(&heap, heap.size - 1);
+		}
+	}
+
+	while (heap.size > 0) {
+		int player = heap.items[0], best = -1;
+
+		removeHeap(&heap, player);
+		// their opponents are tried from the fewest options up, then by the
+		// smallest score gap. Anyone still in the heap has someone left
+		for (int i = start[player]; i < start[player + 1]; i++) {
+			int opponent = opponents[i];
+			if (heap.position[opponent] == -1)
+				continue;
+			if (best == -1 || heap.options[opponent] < heap.options[best]
+					|| (heap.options[opponent] == heap.options[best]
+						&& abs(players[opponent].score - players[player].score)
+						< abs(players[best].score - players[player].score)))
+				best = opponent;
+		}
+
+		mate[player] = best;
+		mate[best] = player;
+		removeHeap(&heap, best);
+		takeOut(&heap, start, opponents, best);
+		takeOut(&heap, start, opponents, player);
+	}
+
+	*size = 0;
+	for (int i = 0; i < totalPlayers; i++)
+		if (mate[i] > i)
+			placePair(pairings, size, &players[i], &players[mate[i]]);
+
+	free(start);
+	free(opponents);
+	free(mate);
+	free(heap.items);
+	free(heap.position);
+	free(heap.options);
+	return pairings;
+}
+
+
+// finds everyone's possible opponents
+static void findOptions(int **start, int **opponents)
+{
+	int numTasks = (totalPlayers + OPTIONS_CHUNK - 1) / OPTIONS_CHUNK, numPairs = 0;
+	OptionsTask *rows = malloc((numTasks + 1) * sizeof(OptionsTask));
+	Task *tasks = malloc((numTasks + 1) * sizeof(Task));
+	int *counts = calloc(totalPlayers + 1, sizeof(int));
+
+	for (int i = 0; i < numTasks; i++) {
+		rows[i].roster = players;
+		rows[i].numPlayers = totalPlayers;
+		rows[i].first = i * OPTIONS_CHUNK;
+		rows[i].last = MIN((i + 1) * OPTIONS_CHUNK, totalPlayers);
+		tasks[i].run = findRows;
+		tasks[i].arg = &rows[i];
+	}
+	runTasks(tasks, numTasks, numThreads);
+
+	for (int i = 0; i < numTasks; i++) {
+		for (int j = 0; j < 2 * rows[i].numPairs; j++)
+			counts[rows[i].pairs[j]]++;
+		numPairs += rows[i].numPairs;
+	}
+	*start = malloc((totalPlayers + 1) * sizeof(int));
+	*opponents = malloc((2 * numPairs + 1) * sizeof(int));
+	(*start)[0] = 0;
+	for (int i = 0; i < totalPlayers; i++)
+		(*start)[i + 1] = (*start)[i] + counts[i];
+
+	// counts is reused as how many of each player's opponents are filled in
+	memset(counts, 0, totalPlayers * sizeof(int));
+	for (int i = 0; i < numTasks; i++) {
+		for (int j = 0; j < rows[i].numPairs; j++) {
+			int player1 = rows[i].pairs[2 * j], player2 = rows[i].pairs[2 * j + 1];
+			(*opponents)[(*start)[player1] + counts[player1]++] = player2;
+			(*opponents)[(*start)[player2] + counts[player2]++] = player1;
+		}
+		free(rows[i].pairs);
+	}
+
+	free(rows);
+	free(tasks);
+	free(counts);
+}
+
+
+// the roster's sorted by score, so everyone's possible opponents are within
+// maxPointDif of them in it
+static void findRows(void *arg)
+{
+	OptionsTask *rows = arg;
+	Player *roster = rows->roster;
+	int pairsCap = 0;
+
+	rows->pairs = NULL;
+	rows->numPairs = 0;
+	for (int i = rows->first; i < rows->last; i++)
+		for (int j = i + 1; j < rows->numPlayers && roster[i].score - roster[j].score <= maxPointDif; j++) {
+			if (!canPair(&roster[i], &roster[j]))
+				continue;
+			if (rows->numPairs == pairsCap) {
+				pairsCap = MAX(2 * pairsCap, 1024);
+				rows->pairs = realloc(rows->pairs, 2 * pairsCap * sizeof(int));
+			}
+			rows->pairs[2 * rows->numPairs] = i;
+			rows->pairs[2 * rows->numPairs++ + 1] = j;
+		}
+}
+
+
+// a player's gone, paired or not, so they're one less option for everyone
+// who could've played them
+static void takeOut(Heap *heap, int *start, int *opponents, int player)
+{
+	for (int i = start[player]; i < start[player + 1]; i++) {
+		int opponent = opponents[i];
+		if (heap->position[opponent] == -1)
+			continue;
+		if (--heap->options[opponent] == 0)
+			removeHeap(heap, opponent);
+		else
+			siftUp(heap, heap->position[opponent]);
+	}
+}
+
+
+static int isBefore(Heap *heap, int player1, int player2)
+{
+	if (heap->options[player1] != heap->options[player2])
+		return heap->options[player1] < heap->options[player2];
+	return player1 < player2;
+}
+
+
+static void removeHeap(Heap *heap, int player)
+{
+	int index = heap->position[player], moved;
+
+	swapItems(heap, index, --heap->size);
+	heap->position[player] = -1;
+	// whoever was last is in their place now, and could belong above or below it
+	if (index < heap->size) {
+		moved = heap->items[index];
+		siftUp(heap, index);
+		siftDown(heap, heap->position[moved]);
+	}
+}
+
+
+static void siftUp(Heap *heap, int index)
+{
+	while (index > 0 && isBefore(heap, heap->items[index], heap->items[(index - 1) / 2])) {
+		swapItems(heap, index, (index - 1) / 2);
+		index = (index - 1) / 2;
+	}
+}
+
+
+static void siftDown(Heap *heap, int index)
+{
+	while (2 * index + 1 < heap->size) {
+		int child = 2 * index + 1;
+
+		if (child + 1 < heap->size && isBefore(heap, heap->items[child + 1], heap->items[child]))
+			child++;
+		if (!isBefore(heap, heap->items[child], heap->items[index]))
+			break;
+		swapItems(heap, index, child);
+		index = child;
+	}
+}
+
+
+static void swapItems(Heap *heap, int index1, int index2)
+{
+	int item = heap->items[index1];
+
+	heap->items[index1] = heap->items[index2];
+	heap->items[index2] = item;
+	heap->position[heap->items[index1]] = index1;
+	heap->position[heap->items[index2]] = index2;
+}
@@ -0,0 +1,8 @@
+#include "misc.h"
+
+#ifndef CONSTRAINED_H
+#define CONSTRAINED_H
+
+Pairing *pairConstrained(int *size);
+
+#endif
@@ -0,0 +1,277 @@
+/* Dutch-system pairing, the way rated events do it (FIDE C.04.3), minus the
+ * colour rules, since nobody here has a colour. Each score group, along with
+ * whoever floated down from the groups above it, is a bracket. The top half
+ * of a bracket (S1) is paired against the bottom half (S2) in order: S1's
+ * first player against S2's first, and so on. Where that isn't legal, S2 is
+ * transposed, trying its orders from the smallest change up, and the first
+ * order that pairs as many players as any order could is the one used. Anyone
+ * left after that is exchanged across the halves if they can be, and whoever
+ * is still left floats down to the next bracket.
+ *
+ * Trying every order of S2 would take forever, so the search never goes down
+ * an order that can't be finished. It keeps a maximum matching between the
+ * halves, and only gives an S2 player to an S1 player if everyone else can
+ * still be matched just as well without them. What comes out is the
+ * lexicographically first maximum matching, which is the first transposition
+ * the rules would have settled on.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "files.h"
+#include "util.h"
+#include "pairing.h"
+#include "dutch.h"
+#include "trace.h"
+
+typedef struct {
+	// indices into players, S1 first
+	int *s1, *s2;
+	int numS1, numS2;
+	// bit j of row i is set if s1[i] can be paired with s2[j]
+	uint64_t *legal;
+	int words;
+	// each player's opponent in the other half, or -1
+	int *mateS1, *mateS2;
+	// the S2 players already looked at by the current augment
+	uint64_t *visited;
+	// the S2 players whose opponents are settled
+	uint64_t *settled;
+} Bracket;
+
+static int pairBracket(Pairing *pairings, int *size, int *members, int numMembers);
+static void matchHalves(Bracket *bracket);
+static void orderMatching(Bracket *bracket);
+static int settlePair(Bracket *bracket, int s1, int s2);
+static int augment(Bracket *bracket, int s1);
+static int compareIndices(const void *index1, const void *index2);
+
+
+Pairing *pairDutch(int *size)
+{
+	TRACE_SCOPE("pairDutch");
+	Pairing *pairings = malloc((totalPlayers / 2 + 1) * sizeof(Pairing));
+	// everyone waiting to be paired in this score group: the floaters from
+	// above, then the group itself
+	int *queue = malloc((totalPlayers + 1) * sizeof(int));
+	// the bracket being paired: whoever's left from the last one, then the
+	// next of the queue
+	int *members = malloc((DUTCH_CHUNK + 1) * sizeof(int));
+	// whoever's floating down to the next score group
+	int *floaters = malloc((totalPlayers + 1) * sizeof(int));
+	int numFloaters = 0, numQueued, numMembers;
+
+	*size = 0;
+	for (int first = 0, last; first < totalPlayers; first = last) {
+		for (last = first + 1; last < totalPlayers && players[last].score == players[first].score; last++)
+			;
+
+		// floaters too far above this group can't be paired with anyone in
+		// it, or anyone below it
+		numQueued = 0;
+		for (int i = 0; i < numFloaters; i++)
+			if (players[floaters[i]].score - maxPointDif <= players[first].score)
+				queue[numQueued++] = floaters[i];
+		for (int i = first; i < last; i++)
+			queue[numQueued++] = i;
+
+		// a big queue is paired a bracket at a time. Only the top half of
+		// what's left of one bracket goes on to the next, so there's always
+		// room for new players, and the rest float down with everyone left
+		// at the end
+		numFloaters = numMembers = 0;
+		for (int next = 0; next < numQueued; ) {
+			while (next < numQueued && numMembers < DUTCH_CHUNK)
+				members[numMembers++] = queue[next++];
+			numMembers = pairBracket(pairings, size, members, numMembers);
+			while (numMembers > DUTCH_CHUNK / 2)
+				floaters[numFloaters++] = members[--numMembers];
+		}
+		for (int i = 0; i < numMembers; i++)
+			floaters[numFloaters++] = members[i];
+		// the roster's in order, so this puts the floaters back in it
+		qsort(floaters, numFloaters, sizeof(int), compareIndices);
+	}
+
+	free(queue);
+	free(members);
+	free(floaters);
+	return pairings;
+}
+
+
+// pairs as much of the bracket as it can. The players left over are moved to
+// the start of members, in order, and how many of them there are is returned
+static int pairBracket(Pairing *pairings, int *size, int *members, int numMembers)
+{
+	Bracket bracket;
+	int numLeft = 0, numFloaters = 0;
+
+	bracket.numS1 = numMembers / 2;
+	bracket.numS2 = numMembers - bracket.numS1;
+	bracket.s1 = members;
+	bracket.s2 = members + bracket.numS1;
+	bracket.words = (bracket.numS2 + WORD_BITS - 1) / WORD_BITS;
+	bracket.legal = calloc(bracket.numS1 * bracket.words + 1, sizeof(uint64_t));
+	bracket.mateS1 = malloc((bracket.numS1 + 1) * sizeof(int));
+	bracket.mateS2 = malloc((bracket.numS2 + 1) * sizeof(int));
+	bracket.visited = malloc((bracket.words + 1) * sizeof(uint64_t));
+	bracket.settled = calloc(bracket.words + 1, sizeof(uint64_t));
+
+	for (int i = 0; i < bracket.numS1; i++) {
+		uint64_t *row = &bracket.legal[i * bracket.words];
+		for (int j = 0; j < bracket.numS2; j++)
+			if (canPair(&players[bracket.s1[i]], &players[bracket.s2[j]]))
+				row[j / WORD_BITS] |= (uint64_t)1 << (j % WORD_BITS);
+		bracket.mateS1[i] = -1;
+	}
+	for (int j = 0; j < bracket.numS2; j++)
+		bracket.mateS2[j] = -1;
+
+	matchHalves(&bracket);
+	orderMatching(&bracket);
+
+	// the pairings come out in S1's order
+	for (int i = 0; i < bracket.numS1; i++)
+		if (bracket.mateS1[i] != -1)
+			schedulePair(pairings, size, &players[bracket.s1[i]], &players[bracket.s2[bracket.mateS1[i]]]);
+
+	// exchanges: whoever's left can still be paired within their own half
+	for (int i = 0; i < numMembers; i++)
+		if (!players[members[i]].paired)
+			members[numLeft++] = members[i];
+	for (int i = 0; i < numLeft; i++)
+		for (int j = i + 1; j < numLeft && !players[members[i]].paired; j++)
+			if (!players[members[j]].paired && canPair(&players[members[i]], &players[members[j]]))
+				schedulePair(pairings, size, &players[members[i]], &players[members[j]]);
+
+	for (int i = 0; i < numLeft; i++)
+		if (!players[members[i]].paired)
+			members[numFloaters++] = members[i];
+
+	free(bracket.legal);
+	free(bracket.mateS1);
+	free(bracket.mateS2);
+	free(bracket.visited);
+	free(bracket.settled);
+	return numFloaters;
+}
+
+
+// finds a maximum matching between the halves, in any order
+static void matchHalves(Bracket *bracket)
+{
+	// most of it can be done greedily, which leaves less for augmenting
+	for (int i = 0; i < bracket->numS1; i++) {
+		uint64_t *row = &bracket->legal[i * bracket->words];
+		for (int w = 0; w < bracket->words && bracket->mateS1[i] == -1; w++) {
+			uint64_t candidates = row[w];
+			while (candidates) {
+				int j = w * WORD_BITS + BSF(candidates);
+				candidates &= candidates - 1;
+				if (bracket->mateS2[j] == -1) {
+					bracket->mateS1[i] = j;
+					bracket->mateS2[j] = i;
+					break;
+				}
+			}
+		}
+	}
+
+	for (int i = 0; i < bracket->numS1; i++)
+		if (bracket->mateS1[i] == -1) {
+			memset(bracket->visited, 0, bracket->words * sizeof(uint64_t));
+			augment(bracket, i);
+		}
+}
+
+
+// settles S1's opponents one at a time, in order, each on the first S2 player
+// that leaves the matching as big as it was
+static void orderMatching(Bracket *bracket)
+{
+	for (int i = 0; i < bracket->numS1; i++) {
+		uint64_t *row = &bracket->legal[i * bracket->words];
+		int isSettled = 0;
+
+		for (int w = 0; w < bracket->words && !isSettled; w++) {
+			uint64_t candidates = row[w] & ~bracket->settled[w];
+			while (candidates && !isSettled) {
+				int j = w * WORD_BITS + BSF(candidates);
+				candidates &= candidates - 1;
+				isSettled = settlePair(bracket, i, j);
+			}
+		}
+		// if nobody would do, s1[i] was unmatched to begin with, and stays that way
+	}
+}
+
+
+// gives s2 to s1 for good, as long as the matching doesn't shrink.
+// Returns 1 if it could; 0 otherwise
+static int settlePair(Bracket *bracket, int s1, int s2)
+{
+	int old = bracket->mateS1[s1], displaced = bracket->mateS2[s2];
+
+	bracket->settled[s2 / WORD_BITS] |= (uint64_t)1 << (s2 % WORD_BITS);
+	if (old == s2)
+		return 1;
+
+	if (old != -1)
+		bracket->mateS2[old] = -1;
+	if (displaced != -1)
+		bracket->mateS1[displaced] = -1;
+	bracket->mateS1[s1] = s2;
+	bracket->mateS2[s2] = s1;
+	// if s2 was free, or s1 wasn't matched at all, nothing's been lost.
+	// Otherwise whoever had s2 needs someone else, and s1's old opponent is
+	// free for them now
+	if (old == -1 || displaced == -1)
+		return 1;
+	memset(bracket->visited, 0, bracket->words * sizeof(uint64_t));
+	if (augment(bracket, displaced))
+		return 1;
+
+	// a failed augment doesn't change anything, so only this needs undoing
+	bracket->mateS1[s1] = old;
+	bracket->mateS2[old] = s1;
+	bracket->mateS1[displaced] = s2;
+	bracket->mateS2[s2] = displaced;
+	bracket->settled[s2 / WORD_BITS] &= ~((uint64_t)1 << (s2 % WORD_BITS));
+	return 0;
+}
+
+
+// looks for an alternating path from s1 to a free S2 player, and flips it if
+// there is one. Settled S2 players are never taken away from their opponents.
+// Returns 1 if s1 was matched; 0 otherwise
+static int augment(Bracket *bracket, int s1)
+{
+	uint64_t *row = &bracket->legal[s1 * bracket->words];
+
+	for (int w = 0; w < bracket->words; w++) {
+		uint64_t candidates = row[w] & ~bracket->visited[w] & ~bracket->settled[w];
+		while (candidates) {
+			int bit = BSF(candidates), j = w * WORD_BITS + bit;
+			candidates &= candidates - 1;
+			// anything visited deeper down is skipped as well
+			if (bracket->visited[w] >> bit & 1)
+				continue;
+			bracket->visited[w] |= (uint64_t)1 << bit;
+			if (bracket->mateS2[j] == -1 || augment(bracket, bracket->mateS2[j])) {
+				bracket->mateS1[s1] = j;
+				bracket->mateS2[j] = s1;
+				return 1;
+			}
+		}
+	}
+	return 0;
+}
+
+
+static int compareIndices(const void *index1, const void *index2)
+{
+	return *(const int *)index1 - *(const int *)index2;
+}
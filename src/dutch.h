@@ -0,0 +1,12 @@
+#include "misc.h"
+
+#ifndef DUTCH_H
+#define DUTCH_H
+
+// brackets with more players than this are paired a piece at a time, so the
+// table of who can play who stays small
+#define DUTCH_CHUNK           4096
+
+Pairing *pairDutch(int *size);
+
+#endif
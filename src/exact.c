@@ -0,0 +1,234 @@
+/* Exact pairing for small rosters. Greedy pairing can leave a player unpaired
+ * when a different choice further up would've paired everyone, and with only
+ * a couple of dozen players it's cheap enough to just find the best pairings
+ * outright: the fewest players left unpaired, then the smallest total score
+ * gap. It's a dynamic program over the subsets of the roster still to be
+ * paired, as bitmasks, which only ever visits the subsets that can actually
+ * come up. It branches on whoever has the fewest options left, and a greedy
+ * pairing gives it a value to beat from the start, so any subset that can't
+ * beat what's already been found is cut short.
+ *
+ * The solver is specialized by size, so the memo's as small as it can be: up
+ * to 16 players the subsets are 16 bits and the memo's a plain table with a
+ * slot for every one of them. Past that they're 32 bits, and the memo's a
+ * hash table. If that gets past EXACT_STATES subsets, the roster's too tangled
+ * to be worth it, and it's left to be paired the usual way.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "util.h"
+#include "pairing.h"
+#include "exact.h"
+#include "trace.h"
+
+#define MASK      uint16_t
+#define BEST      best16
+#define CHOOSE    choose16
+#define BRANCH    branch16
+#define IS_DENSE  1
+#include "exactsolver.h"
+#undef MASK
+#undef BEST
+#undef CHOOSE
+#undef BRANCH
+#undef IS_DENSE
+
+#define MASK      uint32_t
+#define BEST      best32
+#define CHOOSE    choose32
+#define BRANCH    branch32
+#define IS_DENSE  0
+#include "exactsolver.h"
+#undef MASK
+#undef BEST
+#undef CHOOSE
+#undef BRANCH
+#undef IS_DENSE
+
+static void sortClosest(Solver *solver, int player);
+static int greedyValue(Solver *solver);
+static void growMemo(Solver *solver);
+
+
+// pairs the players in the roster, which has at most EXACT_PLAYERS players,
+// as well as they can possibly be paired.
+// Returns 1 if successful; 0 if it would take too long, and nobody's paired
+int pairExact(Player *roster, int numPlayers, Pairing *pairings, int *size)
+{
+	TRACE_SCOPE("pairExact");
+	Solver solver;
+	uint32_t everyone = ((uint32_t)1 << numPlayers) - 1;
+	// the best pairing's worth at least as much as a greedy one
+	int floor;
+
+	solver.roster = roster;
+	solver.numPlayers = numPlayers;
+	solver.isOver = 0;
+	for (int i = 0; i < numPlayers; i++) {
+		solver.score[i] = roster[i].score;
+		solver.mate[i] = -1;
+		solver.eligible[i] = 0;
+		for (int j = 0; j < numPlayers; j++)
+			if (i != j && !roster[i].paired && !roster[j].paired && canPair(&roster[i], &roster[j])) {
+				solver.eligible[i] |= (uint32_t)1 << j;
+				solver.value[i][j] = PAIR_VALUE - abs(roster[i].score - roster[j].score);
+			}
+	}
+
+	for (int i = 0; i < numPlayers; i++)
+		sortClosest(&solver, i);
+	floor = greedyValue(&solver) - 1;
+
+	if (numPlayers <= DENSE_PLAYERS) {
+		solver.table = calloc((size_t)1 << numPlayers, sizeof(int));
+		best16(&solver, everyone, floor);
+		choose16(&solver, everyone);
+		free(solver.table);
+	} else {
+		solver.tableBits = MEMO_BITS;
+		solver.tableUsed = 0;
+		solver.keys = calloc((size_t)1 << solver.tableBits, sizeof(uint32_t));
+		solver.values = malloc(((size_t)1 << solver.tableBits) * sizeof(int));
+		best32(&solver, everyone, floor);
+		choose32(&solver, everyone);
+		free(solver.keys);
+		free(solver.values);
+	}
+	if (solver.isOver)
+		return 0;
+
+	// every pair the solver chose can play, so none of them are dropped for
+	// the sake of staggering them from the match before
+	for (int i = 0; i < numPlayers; i++)
+		if (solver.mate[i] > i)
+			placePair(pairings, size, &roster[i], &roster[solver.mate[i]]);
+	return 1;
+}
+
+
+// the roster's sorted by score, so the closest scores are the nearest players
+// in it, going outwards from them both ways at once
+static void sortClosest(Solver *solver, int player)
+{
+	int above = player - 1, below = player + 1;
+
+	for (int i = 0; i < solver->numPlayers - 1; i++)
+		if (below == solver->numPlayers || (above >= 0
+					&& solver->score[above] - solver->score[player] <= solver->score[player] - solver->score[below]))
+			solver->closest[player][i] = above--;
+		else
+			solver->closest[player][i] = below++;
+}
+
+
+// what pairing each player with the closest one after them they can play is worth
+static int greedyValue(Solver *solver)
+{
+	uint32_t left = ((uint32_t)1 << solver->numPlayers) - 1;
+	int value = 0;
+
+	while (left != 0) {
+		int first = BSF(left);
+		uint32_t candidates;
+
+		left &= left - 1;
+		candidates = solver->eligible[first] & left;
+		for (int i = 0; candidates != 0; i++) {
+			int second = solver->closest[first][i];
+			if (candidates >> second & 1) {
+				value += solver->value[first][second];
+				left &= ~((uint32_t)1 << second);
+				break;
+			}
+		}
+	}
+	return value;
+}
+
+
+// the smallest total score gap the subset could be paired with if everyone
+// could play everyone, leaving one player out if there's an odd number. The
+// roster's sorted by score, so that's pairing neighbours, and the player left
+// out is one that leaves an even number either side of them
+int smallestGap(Solver *solver, uint32_t subset)
+{
+	int scores[EXACT_PLAYERS], numScores = 0;
+	int gap = 0, best;
+
+	for (uint32_t rest = subset; rest != 0; rest &= rest - 1)
+		scores[numScores++] = solver->score[BSF(rest)];
+
+	if (numScores % 2 == 0) {
+		for (int i = 0; i < numScores; i += 2)
+			gap += scores[i] - scores[i + 1];
+		return gap;
+	}
+
+	// leaving the last player out, then moving who's left out up two at a
+	// time: the pair before them comes apart, and the pair after comes together
+	for (int i = 0; i + 1 < numScores; i += 2)
+		gap += scores[i] - scores[i + 1];
+	best = gap;
+	for (int out = numScores - 3; out >= 0; out -= 2) {
+		gap += (scores[out + 1] - scores[out + 2]) - (scores[out] - scores[out + 1]);
+		best = MIN(best, gap);
+	}
+	return best;
+}
+
+
+// returns the value stored for the subset, or 0 if there isn't one
+int lookupMemo(Solver *solver, uint32_t subset)
+{
+	uint32_t mask = ((uint32_t)1 << solver->tableBits) - 1;
+
+	for (uint32_t slot = (subset * 0x9e3779b97f4a7c15) >> (64 - solver->tableBits);
+			solver->keys[slot] != 0; slot = (slot + 1) & mask)
+		if (solver->keys[slot] == subset)
+			return solver->values[slot];
+	return 0;
+}
+
+
+void storeMemo(Solver *solver, uint32_t subset, int value)
+{
+	uint32_t mask, slot;
+
+	if (solver->tableUsed == EXACT_STATES) {
+		solver->isOver = 1;
+		return;
+	}
+	// it's kept at most half full, so the probes stay short
+	if (2 * (solver->tableUsed + 1) > 1 << solver->tableBits)
+		growMemo(solver);
+
+	mask = ((uint32_t)1 << solver->tableBits) - 1;
+	slot = (subset * 0x9e3779b97f4a7c15) >> (64 - solver->tableBits);
+	while (solver->keys[slot] != 0 && solver->keys[slot] != subset)
+		slot = (slot + 1) & mask;
+	solver->tableUsed += solver->keys[slot] == 0;
+	solver->keys[slot] = subset;
+	solver->values[slot] = value;
+}
+
+
+static void growMemo(Solver *solver)
+{
+	uint32_t *keys = solver->keys;
+	int *values = solver->values;
+	int oldSize = 1 << solver->tableBits;
+
+	solver->tableBits++;
+	solver->tableUsed = 0;
+	solver->keys = calloc((size_t)1 << solver->tableBits, sizeof(uint32_t));
+	solver->values = malloc(((size_t)1 << solver->tableBits) * sizeof(int));
+	for (int i = 0; i < oldSize; i++)
+		if (keys[i] != 0)
+			storeMemo(solver, keys[i], values[i]);
+
+	free(keys);
+	free(values);
+}
@@ -0,0 +1,52 @@
+#include <stdint.h>
+
+#include "misc.h"
+
+#ifndef EXACT_H
+#define EXACT_H
+
+// rosters up to this size are paired exactly, instead of greedily. Past
+// it, a roster with a lot of history can take seconds
+#define EXACT_PLAYERS         24
+// up to this size, every subset of the roster gets a slot in the memo
+#define DENSE_PLAYERS         16
+// how big the hashed memo starts, as a power of 2
+#define MEMO_BITS             10
+// the most subsets the hashed memo can hold before the roster's given up on
+// and paired the usual way instead. That keeps it to a few MB
+#define EXACT_STATES          (1 << 18)
+// a pairing is worth this, minus the players' score gap, so no gap is ever
+// worth leaving two more players unpaired
+#define PAIR_VALUE            (1 << 20)
+
+typedef struct {
+	Player *roster;
+	int numPlayers;
+	// bit j of eligible[i] is set if roster[i] can be paired with roster[j]
+	uint32_t eligible[EXACT_PLAYERS];
+	// what pairing roster[i] with roster[j] is worth
+	int value[EXACT_PLAYERS][EXACT_PLAYERS];
+	// everyone's score, which is sorted like the roster
+	int score[EXACT_PLAYERS];
+	// everyone else, for each player, from the closest score to the furthest
+	int closest[EXACT_PLAYERS][EXACT_PLAYERS];
+	// the index of everyone's opponent in the best pairing, or -1
+	int mate[EXACT_PLAYERS];
+	// the best value of each subset of the roster, as in BEST, or 0 if it
+	// hasn't been worked out yet. Either indexed by the subset itself...
+	int *table;
+	// ...or a hash table of just the subsets that come up, keyed by subset.
+	// The empty subset is never stored, so a key of 0 is an empty slot
+	uint32_t *keys;
+	int *values;
+	int tableBits, tableUsed;
+	// set once the memo's gone past EXACT_STATES
+	int isOver;
+} Solver;
+
+int pairExact(Player *roster, int numPlayers, Pairing *pairings, int *size);
+int smallestGap(Solver *solver, uint32_t subset);
+int lookupMemo(Solver *solver, uint32_t subset);
+void storeMemo(Solver *solver, uint32_t subset, int value);
+
+#endif
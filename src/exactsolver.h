@@ -0,0 +1,118 @@
+/* The body of the exact solver, which exact.c includes once for each size of
+ * roster it's specialized for. Before including it, define:
+ * MASK      an unsigned type with a bit for every player
+ * BEST      the name to give the function that finds a subset's best value
+ * CHOOSE    the name to give the function that pairs a subset's best pairing
+ * BRANCH    the name to give the function that picks who to branch on
+ * IS_DENSE  1 to memoize in a table with a slot for every subset, 0 to use
+ *           the hash table
+ */
+
+// takes out everyone in the subset with nobody in it left to play, since they
+// can only sit out, and returns the player with the fewest options of who's
+// left, or -1 if nobody is. Branching on them keeps the branches few
+static int BRANCH(Solver *solver, MASK *subset)
+{
+	MASK live = 0;
+	int player = -1, fewest = EXACT_PLAYERS + 1;
+
+	for (MASK rest = *subset; rest != 0; rest &= rest - 1) {
+		int i = BSF(rest), options = PopCnt((MASK)solver->eligible[i] & *subset);
+		if (options == 0)
+			continue;
+		live |= (MASK)1 << i;
+		if (options < fewest) {
+			fewest = options;
+			player = i;
+		}
+	}
+	*subset = live;
+	return player;
+}
+
+
+// the most a subset of the roster can be worth, if that's more than floor.
+// If it isn't, the value returned is no more than floor, but still no less
+// than what the subset's really worth. The player branched on either sits
+// out, or is paired with someone they're eligible to play, and the rest of
+// the subset is worked out the same way
+static int BEST(Solver *solver, MASK subset, int floor)
+{
+	MASK rest, candidates;
+	int player, best = -1, cached, bound;
+
+	if (solver->isOver)
+		return 0;
+	player = BRANCH(solver, &subset);
+	if (player == -1)
+		return 0;
+
+#if IS_DENSE
+	cached = solver->table[subset];
+#else
+	cached = lookupMemo(solver, subset);
+#endif
+	// the memo holds each value twice over, + 1 if it's exact rather than
+	// just as much as it could be
+	if (cached != 0 && ((cached - 1) % 2 == 1 || (cached - 1) / 2 <= floor))
+		return (cached - 1) / 2;
+
+	// once the subset's as good as it could possibly be, there's no point
+	// looking any further
+	bound = PopCnt(subset) / 2 * PAIR_VALUE - smallestGap(solver, subset);
+	if (cached != 0)
+		bound = MIN(bound, (cached - 1) / 2);
+	if (bound <= floor)
+		return bound;
+
+	rest = subset & ~((MASK)1 << player);
+	candidates = (MASK)solver->eligible[player] & rest;
+	// the closest scores first, so the best found goes up as fast as it can
+	// and more of the rest get cut short
+	for (int i = 0; candidates && best < bound; i++) {
+		int second = solver->closest[player][i], value = solver->value[player][second];
+		if (!(candidates >> second & 1))
+			continue;
+		candidates &= ~((MASK)1 << second);
+		value += BEST(solver, rest & ~((MASK)1 << second), MAX(best, floor) - value);
+		best = MAX(best, value);
+	}
+	if (best < bound)
+		best = MAX(best, BEST(solver, rest, MAX(best, floor)));
+
+#if IS_DENSE
+	solver->table[subset] = 2 * best + (best > floor) + 1;
+#else
+	storeMemo(solver, subset, 2 * best + (best > floor) + 1);
+#endif
+	return best;
+}
+
+
+// follows the best values back down, picking everyone's opponent as it goes.
+// Where there's a tie, the player branched on gets the earliest opponent
+static void CHOOSE(Solver *solver, MASK subset)
+{
+	while (!solver->isOver) {
+		MASK rest, candidates;
+		int player = BRANCH(solver, &subset), best;
+
+		if (player == -1)
+			break;
+		best = BEST(solver, subset, -1);
+		rest = subset & ~((MASK)1 << player);
+		candidates = (MASK)solver->eligible[player] & rest;
+		subset = rest;
+		while (candidates) {
+			int second = BSF(candidates), value = solver->value[player][second];
+			MASK without = rest & ~((MASK)1 << second);
+			candidates &= candidates - 1;
+			if (value + BEST(solver, without, best - value - 1) == best) {
+				solver->mate[player] = second;
+				solver->mate[second] = player;
+				subset = without;
+				break;
+			}
+		}
+	}
+}
@@ -6,21 +6,32 @@
 #define FILE_H
 
 void readInPlayers(void);
+void readPlayer(int playerIdx);
 void getID(int playerIdx);
 void getName(int playerIdx);
 void getPrevPairedPlayers(int playerIdx);
 void getScore(int playerIdx);
 void getTimes(int playerIdx);
-void getDayTimes(uint64_t times[DAYS_IN_WEEK][HOURS_IN_DAY], int day);
-void getDayTime(uint64_t times[DAYS_IN_WEEK][HOURS_IN_DAY], int day);
+void getDayTimes(uint64_t times[DAYS_IN_WEEK][WORDS_IN_DAY], int day);
+void getDayTime(uint64_t times[DAYS_IN_WEEK][WORDS_IN_DAY], int day);
+void getComment(int playerIdx);
 void updateFile();
 void writeLine(FILE *updatedPlayers, Player *player, int mostPairedPlayers, int mostTimeRanges);
 int writePrevPairedIDs(FILE *updatedPlayers, Player *player, int mostPairedPlayers);
 void writeAllTimes(FILE *updatedPlayers, Player *player, int mostTimeRanges);
+void writeComment(FILE *updatedPlayers, FILE *playerList, Player *player);
 void printError(int errorCode);
+void watchPlayers(void);
+void sortPlayers(void);
+void bucketPlayers(int *counts, int maxScore);
+void freePlayerList(void);
+void freePlayer(Player *player);
 
-extern Player *players;
-extern int totalPlayers, longestName, longestPlayerID;
+extern _Thread_local Player *players;
+extern _Thread_local int totalPlayers, longestName, longestPlayerID;
 extern int dayOfWeek;
+extern int isLowMemory;
+extern _Thread_local char *playerFile, *updatedPlayerFile;
+extern _Thread_local FILE *fp;
 
 #endif
@@ -0,0 +1,424 @@
+/* A local search that improves on the pairings from the first pass. Each
+ * thread starts from the same pairings and makes random swaps with its own
+ * seed, keeping the best set it's seen: first by the fewest unpaired players,
+ * then by the smallest total score gap. Once the time budget runs out, the
+ * best set across all threads is given its times, and replaces the original
+ * if it's still better once it has them.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "files.h"
+#include "util.h"
+#include "pairing.h"
+#include "trace.h"
+
+// how many moves are made between checks of the clock
+#define MOVES_PER_CHECK       256
+
+typedef struct {
+	// the index of each player's opponent, or -1 if they're unpaired
+	int *mate;
+	// the unpaired players, and where each player is in that list
+	int *unpaired, *unpairedPos;
+	int numUnpaired;
+	// the sum of the score differences of every pairing, in half points
+	int gap;
+
+	int *bestMate;
+	int bestUnpaired, bestGap;
+
+	uint64_t seed;
+	struct timespec deadline;
+
+	// the roster and windows of the thread that started the search
+	Player *roster;
+	int numPlayers;
+	int *windowStart, *windowEnd;
+} Search;
+
+static _Thread_local int *windowStart, *windowEnd;
+
+static void initSearch(Search *search, int *mate, uint64_t seed, struct timespec deadline);
+static void freeSearch(Search *search);
+static void *runSearch(void *arg);
+static void tryAugment(Search *search, int p1);
+static void tryTwoOpt(Search *search);
+static void joinPair(Search *search, int p1, int p2);
+static void splitPair(Search *search, int p1);
+static int isBetter(int unpaired, int gap, int bestUnpaired, int bestGap);
+static int canEverPair(int player);
+static int scoreGap(int p1, int p2);
+static int randomInWindow(Search *search, int player);
+static uint64_t nextRandom(uint64_t *seed);
+static int isPastDeadline(struct timespec deadline);
+static void rebuildPairings(Pairing *pairings, int *size, int *mate);
+static void restorePairings(Pairing *pairings, int size);
+static void rollBackHistory(Pairing *pairings, int size);
+static int totalGap(Pairing *pairings, int size);
+
+
+void improvePairings(Pairing **pairings, int *size)
+{
+	TRACE_SCOPE("improvePairings");
+	pthread_t threads[MAX_THREADS];
+	Search searches[MAX_THREADS];
+	int *initialMate = malloc(totalPlayers * sizeof(int));
+	// only counting the players the searches do, so they're compared like for like
+	int initialUnpaired = 0, initialGap = 0;
+	int best = -1;
+	struct timespec deadline;
+
+	if (totalPlayers < 2) {
+		free(initialMate);
+		return;
+	}
+
+	for (int i = 0; i < totalPlayers; i++)
+		initialMate[i] = -1;
+	for (int match = 0; match < *size; match++) {
+		int p1 = (*pairings)[match].p1 - players, p2 = (*pairings)[match].p2 - players;
+		initialMate[p1] = p2;
+		initialMate[p2] = p1;
+	}
+	for (int i = 0; i < totalPlayers; i++)
+		initialUnpaired += initialMate[i] == -1 && canEverPair(i);
+	initialGap = totalGap(*pairings, *size);
+	// the first pass has already added these opponents to each other's
+	// history, which would make every one of them illegal
+	rollBackHistory(*pairings, *size);
+
+	// the players are sorted by score, so the ones close enough in score
+	// to a player are always a contiguous range around them
+	windowStart = malloc(totalPlayers * sizeof(int));
+	windowEnd = malloc(totalPlayers * sizeof(int));
+	for (int i = 0, start = 0, end = 0; i < totalPlayers; i++) {
+		while (players[start].score - players[i].score > maxPointDif)
+			start++;
+		while (end < totalPlayers && players[i].score - players[end].score <= maxPointDif)
+			end++;
+		windowStart[i] = start;
+		windowEnd[i] = end;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	deadline.tv_sec += budgetMs / 1000;
+	deadline.tv_nsec += (long)(budgetMs % 1000) * 1000000;
+	if (deadline.tv_nsec >= 1000000000) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000;
+	}
+
+	for (int i = 0; i < numThreads; i++) {
+		initSearch(&searches[i], initialMate, 0x9e3779b97f4a7c15ull * (i + 1), deadline);
+		pthread_create(&threads[i], NULL, runSearch, &searches[i]);
+	}
+	for (int i = 0; i < numThreads; i++) {
+		pthread_join(threads[i], NULL);
+		if (isBetter(searches[i].bestUnpaired, searches[i].bestGap, initialUnpaired, initialGap)
+				&& (best == -1 || isBetter(searches[i].bestUnpaired, searches[i].bestGap,
+						searches[best].bestUnpaired, searches[best].bestGap)))
+			best = i;
+	}
+
+	// the original pairings are left exactly as they were unless the new ones
+	// are better once they've been given their times, and kept every pair
+	// the search chose
+	if (best != -1) {
+		Pairing *rebuilt = malloc((totalPlayers / 2 + 1) * sizeof(Pairing));
+		int rebuiltSize, numChosen = 0;
+
+		for (int i = 0; i < totalPlayers; i++)
+			numChosen += searches[best].bestMate[i] > i;
+		rebuildPairings(rebuilt, &rebuiltSize, searches[best].bestMate);
+		if (rebuiltSize == numChosen && isBetter(totalPlayers - 2 * rebuiltSize, totalGap(rebuilt, rebuiltSize),
+					totalPlayers - 2 * *size, totalGap(*pairings, *size))) {
+			free(*pairings);
+			*pairings = rebuilt;
+			*size = rebuiltSize;
+		} else {
+			rollBackHistory(rebuilt, rebuiltSize);
+			free(rebuilt);
+			best = -1;
+		}
+	}
+	if (best == -1)
+		restorePairings(*pairings, *size);
+
+	for (int i = 0; i < numThreads; i++)
+		freeSearch(&searches[i]);
+	free(initialMate);
+	free(windowStart);
+	free(windowEnd);
+}
+
+
+static void initSearch(Search *search, int *mate, uint64_t seed, struct timespec deadline)
+{
+	search->mate = malloc(totalPlayers * sizeof(int));
+	search->bestMate = malloc(totalPlayers * sizeof(int));
+	search->unpaired = malloc(totalPlayers * sizeof(int));
+	search->unpairedPos = malloc(totalPlayers * sizeof(int));
+	search->numUnpaired = 0;
+	search->gap = 0;
+
+	memcpy(search->mate, mate, totalPlayers * sizeof(int));
+	for (int i = 0; i < totalPlayers; i++) {
+		// players without a long enough window can never be paired, so
+		// there's no point trying
+		if (mate[i] == -1 && canEverPair(i)) {
+			search->unpairedPos[i] = search->numUnpaired;
+			search->unpaired[search->numUnpaired++] = i;
+		} else if (i < mate[i]) {
+			search->gap += scoreGap(i, mate[i]);
+		}
+	}
+
+	memcpy(search->bestMate, mate, totalPlayers * sizeof(int));
+	search->bestUnpaired = search->numUnpaired;
+	search->bestGap = search->gap;
+	search->seed = seed;
+	search->deadline = deadline;
+	search->roster = players;
+	search->numPlayers = totalPlayers;
+	search->windowStart = windowStart;
+	search->windowEnd = windowEnd;
+}
+
+
+static void freeSearch(Search *search)
+{
+	free(search->mate);
+	free(search->bestMate);
+	free(search->unpaired);
+	free(search->unpairedPos);
+}
+
+
+static void *runSearch(void *arg)
+{
+	Search *search = arg;
+
+	players = search->roster;
+	totalPlayers = search->numPlayers;
+	windowStart = search->windowStart;
+	windowEnd = search->windowEnd;
+
+	while (!isPastDeadline(search->deadline)) {
+		for (int move = 0; move < MOVES_PER_CHECK; move++) {
+			// try to pair someone who isn't, half of the time if
+			// there's anyone to pair; otherwise, tighten the score gaps
+			if (search->numUnpaired > 0 && nextRandom(&search->seed) & 1)
+				tryAugment(search, search->unpaired[nextRandom(&search->seed) % search->numUnpaired]);
+			else
+				tryTwoOpt(search);
+
+			if (isBetter(search->numUnpaired, search->gap, search->bestUnpaired, search->bestGap)) {
+				memcpy(search->bestMate, search->mate, totalPlayers * sizeof(int));
+				search->bestUnpaired = search->numUnpaired;
+				search->bestGap = search->gap;
+			}
+		}
+		// nothing left to improve
+		if (search->bestUnpaired <= 1 && search->bestGap == 0)
+			break;
+	}
+
+	return NULL;
+}
+
+
+// tries to give p1, who's unpaired, an opponent
+static void tryAugment(Search *search, int p1)
+{
+	int p2 = randomInWindow(search, p1);
+	int oldMate, newMate;
+
+	if (p2 == p1 || !canPair(&players[p1], &players[p2]))
+		return;
+
+	if (search->mate[p2] == -1) {
+		joinPair(search, p1, p2);
+		return;
+	}
+
+	// p1 takes p2 from its opponent, which then needs a new one out of
+	// the other unpaired players
+	oldMate = search->mate[p2];
+	newMate = search->unpaired[nextRandom(&search->seed) % search->numUnpaired];
+	if (newMate != p1 && canPair(&players[oldMate], &players[newMate])) {
+		splitPair(search, p2);
+		joinPair(search, p1, p2);
+		joinPair(search, oldMate, newMate);
+		return;
+	}
+
+	// if the opponent can't be re-paired, swapping p1 in for it doesn't change
+	// how many players are unpaired. It's worth doing if it tightens the
+	// score gap, and now and then regardless, so the search doesn't get stuck
+	if (scoreGap(p1, p2) < scoreGap(oldMate, p2) || (nextRandom(&search->seed) & 15) == 0) {
+		splitPair(search, p2);
+		joinPair(search, p1, p2);
+	}
+}
+
+
+// swaps the opponents of two pairings, if it makes the total score gap smaller
+static void tryTwoOpt(Search *search)
+{
+	int p1 = nextRandom(&search->seed) % totalPlayers;
+	int p2 = search->mate[p1], p3, p4;
+	int oldGap;
+
+	if (p2 == -1)
+		return;
+	p3 = randomInWindow(search, p1);
+	p4 = search->mate[p3];
+	if (p4 == -1 || p3 == p1 || p3 == p2)
+		return;
+
+	oldGap = scoreGap(p1, p2) + scoreGap(p3, p4);
+	if (scoreGap(p1, p3) + scoreGap(p2, p4) < oldGap
+			&& canPair(&players[p1], &players[p3]) && canPair(&players[p2], &players[p4])) {
+		splitPair(search, p1);
+		splitPair(search, p3);
+		joinPair(search, p1, p3);
+		joinPair(search, p2, p4);
+	} else if (scoreGap(p1, p4) + scoreGap(p2, p3) < oldGap
+			&& canPair(&players[p1], &players[p4]) && canPair(&players[p2], &players[p3])) {
+		splitPair(search, p1);
+		splitPair(search, p3);
+		joinPair(search, p1, p4);
+		joinPair(search, p2, p3);
+	}
+}
+
+
+// pairs 2 unpaired players
+static void joinPair(Search *search, int p1, int p2)
+{
+	int pair[2] = { p1, p2 };
+
+	for (int i = 0; i < 2; i++) {
+		// swap-remove it from the unpaired list
+		int pos = search->unpairedPos[pair[i]];
+		int last = search->unpaired[--search->numUnpaired];
+		search->unpaired[pos] = last;
+		search->unpairedPos[last] = pos;
+	}
+	search->mate[p1] = p2;
+	search->mate[p2] = p1;
+	search->gap += scoreGap(p1, p2);
+}
+
+
+// unpairs a player and their opponent
+static void splitPair(Search *search, int p1)
+{
+	int p2 = search->mate[p1];
+
+	search->gap -= scoreGap(p1, p2);
+	search->mate[p1] = search->mate[p2] = -1;
+	search->unpairedPos[p1] = search->numUnpaired;
+	search->unpaired[search->numUnpaired++] = p1;
+	search->unpairedPos[p2] = search->numUnpaired;
+	search->unpaired[search->numUnpaired++] = p2;
+}
+
+
+static int isBetter(int unpaired, int gap, int bestUnpaired, int bestGap)
+{
+	return unpaired < bestUnpaired || (unpaired == bestUnpaired && gap < bestGap);
+}
+
+
+// players without a long enough window can never be paired, so they aren't
+// counted as unpaired
+static int canEverPair(int player)
+{
+	return players[player].longestRun[dayOfWeek] >= minTimeDif;
+}
+
+
+static int scoreGap(int p1, int p2)
+{
+	return abs(players[p1].score - players[p2].score);
+}
+
+
+// a random player that's close enough in score to be paired against player
+static int randomInWindow(Search *search, int player)
+{
+	return windowStart[player]
+		+ nextRandom(&search->seed) % (windowEnd[player] - windowStart[player]);
+}
+
+
+// xorshift64
+static uint64_t nextRandom(uint64_t *seed)
+{
+	*seed ^= *seed << 13;
+	*seed ^= *seed >> 7;
+	*seed ^= *seed << 17;
+	return *seed;
+}
+
+
+static int isPastDeadline(struct timespec deadline)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec > deadline.tv_sec
+		|| (now.tv_sec == deadline.tv_sec && now.tv_nsec >= deadline.tv_nsec);
+}
+
+
+// fills in pairings with the ones in mate, in the order of the roster, giving
+// each one a time the same way constrained pairing does
+static void rebuildPairings(Pairing *pairings, int *size, int *mate)
+{
+	for (int i = 0; i < totalPlayers; i++)
+		players[i].paired = 0;
+	*size = 0;
+
+	for (int p1 = 0; p1 < totalPlayers; p1++)
+		if (mate[p1] > p1)
+			placePair(pairings, size, &players[p1], &players[mate[p1]]);
+}
+
+
+// puts the pairings' players back the way the first pass left them
+static void restorePairings(Pairing *pairings, int size)
+{
+	for (int i = 0; i < totalPlayers; i++)
+		players[i].paired = 0;
+	for (int match = 0; match < size; match++) {
+		addPairedPlayer(pairings[match].p1, pairings[match].p2);
+		pairings[match].p1->paired = pairings[match].p2->paired = 1;
+	}
+}
+
+
+// each pairing's opponents are the last ones added to the players' histories
+static void rollBackHistory(Pairing *pairings, int size)
+{
+	for (int match = 0; match < size; match++) {
+		pairings[match].p1->prevPlayedNum--;
+		pairings[match].p2->prevPlayedNum--;
+	}
+}
+
+
+static int totalGap(Pairing *pairings, int size)
+{
+	int gap = 0;
+
+	for (int match = 0; match < size; match++)
+		gap += abs(pairings[match].p1->score - pairings[match].p2->score);
+	return gap;
+}
@@ -8,19 +8,22 @@
 #include <string.h>
 #include <ctype.h>
 #include <stdint.h>
+#include <unistd.h>
 
 #include "misc.h"
 #include "util.h"
 #include "files.h"
-
-#define SLOTS                 MINUTES_IN_HOUR
-
-typedef struct {
-	// player 1, player 2
-	Player *p1, *p2;
-	float time;
-	unsigned int isEarliest : 1;
-} Pairing;
+#include "output.h"
+#include "pairing.h"
+#include "pool.h"
+#include "archive.h"
+#include "simulate.h"
+#include "batch.h"
+#include "pipeline.h"
+#include "dutch.h"
+#include "exact.h"
+#include "constrained.h"
+#include "trace.h"
 
 enum daysOfWeek {
 	MONDAY,
@@ -38,55 +41,98 @@ enum daysOfWeek {
 TODO: have you heard of *structs*? Refactor, idiot. And in any case, you have a
 function with *seven* damn parameters.
  */
-Player *players;
-int totalPlayers, longestName, longestPlayerID;
-// inclusive maximum point difference between opponents that can be paired
-float maxPointDif;
-// the earliest time a match can take place
-float earliestTime;
+// the roster, and everything about it, belongs to a thread, so that in batch
+// mode each thread can pair a different section. Any thread helping pair a
+// roster has to be pointed at it first
+_Thread_local Player *players;
+_Thread_local int totalPlayers, longestName, longestPlayerID;
+// inclusive maximum point difference between opponents that can be paired, in half points
+int maxPointDif;
+// the earliest time a match can take place, in minutes since midnight
+int earliestTime;
 // the minimum gap that's between matches, in minutes
 int minTimeDif;
 // 0: monday, 6: sunday
 int dayOfWeek;
-int unpairedPlayers;
+_Thread_local int unpairedPlayers;
 int isVisual;
+// one of enum formats
+int outputFormat;
+// if set, the roster isn't printed before the pairings
+int isQuiet;
+// if set, comments are left in the roster file instead of being kept in memory
+int isLowMemory;
+// if set, the roster is kept in memory and re-paired whenever it's saved
+int isWatching;
+// how many threads pair the score groups
+int numThreads;
+// one of enum modes
+int pairingMode;
+// how long the pairings can be improved for after the first pass, in
+// milliseconds. 0 skips improving them
+int budgetMs;
 
 void initGlobalVars();
 void handleArgs(int argc, char *argv[]);
-void handleArg(char *arg, char *nextArg);
-void handleOption(char *arg, char *nextArg);
-void pairPlayers(void);
-Pairing *matchPlayer(Pairing *pairings, int *size, int p1Idx);
-// returns 1 if successful; 1 otherwise
-int pairPlayer(Pairing *pairings, int *size, int p1Idx, int search, float startTime, float endTime, float minHourDif);
-void addPairedPlayer(Player *player1, Player *player2);
-void printPlayers(void);
+// returns the number of arguments used after arg
+int handleOption(char *arg, char *nextArg);
+int parseGrid(char *list, int *grid, float scale);
+Pairing *pairGroups(int *size);
+int compareTasks(const void *task1, const void *task2);
 void printTimes(Player player);
-void printPairings(Pairing *pairings, int size);
-void printTime(FILE *stream, int hour, int minute);
-void sortPlayers(void);
-// Time (as a float) TO Token
-char *ttot(float timeFloat);
-void swap(Player *player1, Player *player2);
-void freePlayerList(void);
-int haveFought(Player p1, Player p2);
+void printJSONPlayer(Player *player);
+void printPaddedID(int id);
+// Time (in minutes since midnight) TO Token
+char *ttot(int time);
 
 
 int main(int argc, char *argv[])
 {
+	TRACE_START();
 	initGlobalVars();
 	handleArgs(argc, argv);
-	readInPlayers();
-	sortPlayers();
-	printPlayers();
-	pairPlayers();
-	updateFile();
+	if (archiveFile != NULL)
+		openArchive();
+	if (batchPath != NULL) {
+		runBatch();
+		closeArchive();
+		return 0;
+	}
+	if (isWatching)
+		watchPlayers();
+	if (simRounds > 0) {
+		readInPlayers();
+		sortPlayers();
+		simulate();
+	} else {
+		if (isPipelined) {
+			runPipeline();
+		} else {
+			readInPlayers();
+			sortPlayers();
+			publishPairings();
+		}
+		if (archiveFile != NULL)
+			updateArchive();
+	}
+	closeArchive();
 	freePlayerList();
 
 	return 0;
 }
 
 
+// pairs the (already sorted) players, then prints and saves the results
+void publishPairings()
+{
+	beginOutput();
+	printPlayers();
+	pairPlayers();
+	endOutput();
+	updateFile();
+}
+
+
 void initGlobalVars()
 {
 	totalPlayers = 0;
@@ -94,10 +140,17 @@ void initGlobalVars()
 
 	// defaults
 	dayOfWeek = SATURDAY;
-	maxPointDif = 1.0;
-	earliestTime = 12.0;
+	maxPointDif = 2;
+	earliestTime = 12 * MINUTES_IN_HOUR;
 	minTimeDif = 30;
 	isVisual = 0;
+	outputFormat = FORMAT_TEXT;
+	isQuiet = 0;
+	isLowMemory = 0;
+	isWatching = 0;
+	numThreads = MIN(MAX(sysconf(_SC_NPROCESSORS_ONLN), 1), MAX_THREADS);
+	budgetMs = 0;
+	pairingMode = MODE_GREEDY;
 }
 
 
@@ -109,11 +162,11 @@ void handleArgs(int argc, char *argv[])
 	}
 
 	for (int i = 1; i < argc; i++)
-		handleArg(argv[i], i < argc - 1 ? argv[i + 1] : NULL);
+		i += handleArg(argv[i], i < argc - 1 ? argv[i + 1] : NULL);
 }
 
 
-void handleArg(char *arg, char *nextArg)
+int handleArg(char *arg, char *nextArg)
 {
 	if (arg[0] != '-') {
 		fprintf(stderr, "Unknown argument \"%s\"\n", arg);
@@ -123,11 +176,11 @@ void handleArg(char *arg, char *nextArg)
 		fprintf(stderr, "Unknown argument \"%s\"\n", arg);
 		exit(0);
 	}
-	handleOption(arg, nextArg);
+	return handleOption(arg, nextArg);
 }
 
 
-void handleOption(char *arg, char *nextArg)
+int handleOption(char *arg, char *nextArg)
 {
 	switch (arg[1]) {
 		// day of week
@@ -135,42 +188,165 @@ void handleOption(char *arg, char *nextArg)
 			if (nextArg == NULL)
 				break;
 
-			if (nextArg[1] != '\0' || TODIGIT(nextArg[0]) > 6) {
+			if (parseDay(nextArg) == -1) {
 				fprintf(stderr,
 					"Day of week given outside range\n");
 				exit(0);
 			}
-			dayOfWeek = TODIGIT(nextArg[0]);
-			break;
+			dayOfWeek = parseDay(nextArg);
+			return 1;
 
 		// max point difference
 		case 'p':
 			if (nextArg == NULL)
 				break;
 
-			sscanf(nextArg, "%f", &maxPointDif);
-			break;
+			// it's given in points, but stored in half points
+			numPointDifs = parseGrid(nextArg, pointDifGrid, 2);
+			if (numPointDifs > 0)
+				maxPointDif = pointDifGrid[0];
+			return 1;
 
 		// earliest time
 		case 'e':
 			if (nextArg == NULL)
 				break;
 
-			sscanf(nextArg, "%f", &earliestTime);
-			break;
+			// it's given in hours, but stored in minutes
+			numEarliests = parseGrid(nextArg, earliestGrid, MINUTES_IN_HOUR);
+			if (numEarliests > 0)
+				earliestTime = earliestGrid[0];
+			return 1;
 
 		// min time difference
 		case 't':
 			if (nextArg == NULL)
 				break;
 
-			sscanf(nextArg, "%d", &minTimeDif);
-			break;
+			numTimeDifs = parseGrid(nextArg, timeDifGrid, 1);
+			if (numTimeDifs > 0)
+				minTimeDif = timeDifGrid[0];
+			return 1;
 
 		// print visual times
 		case 'v':
 			isVisual = 1;
 			break;
+
+		// output format
+		case 'f':
+			if (nextArg == NULL)
+				break;
+
+			if (!strcmp(nextArg, "text"))
+				outputFormat = FORMAT_TEXT;
+			else if (!strcmp(nextArg, "csv"))
+				outputFormat = FORMAT_CSV;
+			else if (!strcmp(nextArg, "json"))
+				outputFormat = FORMAT_JSON;
+			else {
+				fprintf(stderr, "Unknown output format \"%s\"\n", nextArg);
+				exit(0);
+			}
+			return 1;
+
+		// pairing mode
+		case 'm':
+			if (nextArg == NULL)
+				break;
+
+			if (parseMode(nextArg) == -1) {
+				fprintf(stderr, "Unknown pairing mode \"%s\"\n", nextArg);
+				exit(0);
+			}
+			pairingMode = parseMode(nextArg);
+			return 1;
+
+		// don't print the roster
+		case 'q':
+			isQuiet = 1;
+			break;
+
+		// keep the comments out of memory
+		case 'l':
+			isLowMemory = 1;
+			break;
+
+		// watch the roster for changes
+		case 'w':
+			isWatching = 1;
+			break;
+
+		// number of threads
+		case 'j':
+			if (nextArg == NULL)
+				break;
+
+			sscanf(nextArg, "%d", &numThreads);
+			numThreads = MIN(MAX(numThreads, 1), MAX_THREADS);
+			return 1;
+
+		// time budget for improving the pairings
+		case 'b':
+			if (nextArg == NULL)
+				break;
+
+			sscanf(nextArg, "%d", &budgetMs);
+			return 1;
+
+		// head-to-head archive
+		case 'a':
+			if (nextArg == NULL)
+				break;
+
+			archiveFile = nextArg;
+			return 1;
+
+		// roster file
+		case 'i':
+			if (nextArg == NULL)
+				break;
+
+			playerFile = nextArg;
+			return 1;
+
+		// where the updated roster goes, or in batch mode, every section's files
+		case 'o':
+			if (nextArg == NULL)
+				break;
+
+			updatedPlayerFile = outputDir = nextArg;
+			return 1;
+
+		// pipeline reading, pairing and printing
+		case 'P':
+			isPipelined = 1;
+			break;
+
+		// pair every roster in a directory or manifest
+		case 'B':
+			if (nextArg == NULL)
+				break;
+
+			batchPath = nextArg;
+			return 1;
+
+		// number of rounds to simulate
+		case 's':
+			if (nextArg == NULL)
+				break;
+
+			sscanf(nextArg, "%d", &simRounds);
+			return 1;
+
+		// number of times to simulate them
+		case 'n':
+			if (nextArg == NULL)
+				break;
+
+			sscanf(nextArg, "%d", &simRuns);
+			simRuns = MAX(simRuns, 1);
+			return 1;
 			
 		// print help
 		case 'h':
@@ -180,102 +356,269 @@ void handleOption(char *arg, char *nextArg)
 			       "  -p <point difference> Set maximum point difference. Default %.1f.\n"
 			       "  -e <time>             Set earliest time, as a float. 12.5 is 12:30, for example. Default %.1f.\n"
 			       "  -t <time difference>  Set the minimum gap between matchups. Default %d.\n"
-			       "  -v                    Print the times visually.\n",
-					dayOfWeek, maxPointDif, earliestTime, minTimeDif);
+			       "  -v                    Print the times visually.\n"
+			       "  -f <format>           Set the output format: text, csv or json. Default text.\n"
+			       "  -m <mode>             Set how players are paired: greedy, dutch or constrained. Default greedy.\n"
+			       "  -q                    Don't print the roster before the pairings.\n"
+			       "  -l                    Low memory mode: copy comments from the roster instead of keeping them.\n"
+			       "  -w                    Watch the roster and re-pair the players whenever it's saved.\n"
+			       "                        Type \"list\", \"back <snapshot>\" or \"try <options>\" to see, go back to or try other versions.\n"
+			       "  -j <threads>          Set how many threads pair the players. Default %d.\n"
+			       "  -b <milliseconds>     Spend up to this long improving greedy or constrained pairings. Default %d.\n"
+			       "  -a <archive file>     Never pair players who've met in any event in this archive, and add this round to it.\n"
+			       "  -P                    Read, pair and print at the same time, on separate threads.\n"
+			       "  -i <roster file>      Read the players from this file. Default Players.txt.\n"
+			       "  -o <file>             Write the updated roster to this file. Default newPlayerList.txt.\n"
+			       "  -B <directory>        Pair every .txt roster in the directory (or every roster listed in the file,\n"
+			       "                        one per line) at once, and print a summary. Each section's pairings and updated\n"
+			       "                        roster go next to its roster, or in the directory given to -o.\n"
+			       "  -s <rounds>           Simulate this many rounds with random results instead of pairing this one.\n"
+			       "                        -p, -t and -e can then be comma-separated lists, and every combination is tried.\n"
+			       "  -n <runs>             Set how many times the rounds are simulated. Default %d.\n",
+					dayOfWeek, maxPointDif / 2.0, earliestTime / (float)MINUTES_IN_HOUR, minTimeDif,
+					numThreads, budgetMs, simRuns);
 			exit(0);
 
 		default:
 			fprintf(stderr, "unknown argument \"%s\"", arg);
 			exit(0);
 	}
+
+	return 0;
+}
+
+
+// returns the day of the week given, or -1 if it isn't one
+int parseDay(char *day)
+{
+	if (day[0] < '0' || day[0] > '6' || day[1] != '\0')
+		return -1;
+	return TODIGIT(day[0]);
+}
+
+
+// returns the pairing mode given, or -1 if it isn't one
+int parseMode(char *mode)
+{
+	if (!strcmp(mode, "greedy"))
+		return MODE_GREEDY;
+	if (!strcmp(mode, "dutch"))
+		return MODE_DUTCH;
+	if (!strcmp(mode, "constrained"))
+		return MODE_CONSTRAINED;
+	return -1;
+}
+
+
+// parses a comma-separated list of numbers into grid, multiplying each one by
+// scale. Returns how many there were
+int parseGrid(char *list, int *grid, float scale)
+{
+	int numValues = 0;
+	float value;
+
+	for (char *item = strtok(list, ","); item != NULL && numValues < MAX_GRID; item = strtok(NULL, ","))
+		if (sscanf(item, "%f", &value) == 1)
+			grid[numValues++] = (int)(value * scale + 0.5);
+	return numValues;
 }
 
 
 void pairPlayers()
 {
+	TRACE_SCOPE("pairPlayers");
 	int size = 0;
-	Pairing *pairings = malloc(size);
-
+	Pairing *pairings = NULL;
+
+	if (pairingMode == MODE_DUTCH) {
+		// the Dutch system's pairings are the ones the rules ask for, so
+		// they're left alone
+		pairings = pairDutch(&size);
+	} else if (totalPlayers <= EXACT_PLAYERS) {
+		// these are already the best there are, so there's nothing to improve
+		pairings = malloc((totalPlayers / 2 + 1) * sizeof(Pairing));
+		if (!pairExact(players, totalPlayers, pairings, &size)) {
+			free(pairings);
+			pairings = NULL;
+		}
+	}
+	if (pairings == NULL) {
+		if (pairingMode == MODE_CONSTRAINED)
+			pairings = pairConstrained(&size);
+		else
+			pairings = pairGroups(&size);
+		if (budgetMs > 0)
+			improvePairings(&pairings, &size);
+	}
 
-	for (int player = 0; player < totalPlayers - 1; player++) {
-		pairings = matchPlayer(pairings, &size, player);
+	unpairedPlayers = 0;
+	for (int player = 0; player < totalPlayers; player++)
 		if (players[player].paired == 0)
 			unpairedPlayers++;
-	}
-	// the last player isn't checked in the for loop, so this covers that edge case
-	if (players[totalPlayers - 1].paired == 0)
-		unpairedPlayers++;
 
 	printPairings(pairings, size);
+	printUnpaired();
+	printStats(size);
 	free(pairings);
 	
-	printf("Unpaired players: ");
-	if (unpairedPlayers == 0) {
-		printf("None\n");
-		return;
+	return;
+}
+
+
+/* Players more than maxPointDif apart can never be paired, so wherever there's
+ * a bigger gap than that between neighbouring scores, the players either side
+ * are paired independently, on as many threads as there are. Each group's
+ * pairings only depend on that group, so the result is the same however many
+ * threads there are.
+ */
+Pairing *pairGroups(int *size)
+{
+	int numTasks = 0, numSplit = 0;
+	PairingTask *ranges = malloc((totalPlayers + 1) * sizeof(PairingTask));
+	// the groups that were too big and were split up
+	PairingTask *split = malloc((totalPlayers + 1) * sizeof(PairingTask));
+	Task *tasks = malloc((totalPlayers + 1) * sizeof(Task));
+	Pairing *pairings;
+
+	for (int first = 0, last = 1; first < totalPlayers; first = last++) {
+		while (last < totalPlayers && players[last - 1].score - players[last].score <= maxPointDif)
+			last++;
+
+		for (int chunk = first; chunk < last; chunk += GROUP_CHUNK) {
+			ranges[numTasks].roster = players;
+			ranges[numTasks].first = chunk;
+			ranges[numTasks++].last = MIN(chunk + GROUP_CHUNK, last);
+		}
+		if (last - first > GROUP_CHUNK) {
+			split[numSplit].roster = players;
+			split[numSplit].first = first;
+			split[numSplit++].last = last;
+		}
 	}
-	for (int i = 0; i < totalPlayers; i++)
-		if (players[i].paired == 0) {
-			printf("%s (id: %d)", players[i].name, players[i].id);
-			if (--unpairedPlayers > 0)
-				printf(", ");
+
+	// the biggest ranges go first, so they don't hold everyone else up at the end.
+	// The ranges are merged back in order afterwards, so this doesn't change anything
+	for (int i = 0; i < numTasks; i++) {
+		tasks[i].run = pairRange;
+		tasks[i].arg = &ranges[i];
+	}
+	qsort(tasks, numTasks, sizeof(Task), compareTasks);
+	runTasks(tasks, numTasks, numThreads);
+
+	// then the leftovers of each split group get another go across the whole group
+	for (int i = 0; i < numSplit; i++) {
+		tasks[i].run = pairRange;
+		tasks[i].arg = &split[i];
+	}
+	runTasks(tasks, numSplit, numThreads);
+
+	// every pairing takes two players, so this is as many as there can be
+	pairings = malloc((totalPlayers / 2 + 1) * sizeof(Pairing));
+
+	*size = 0;
+	for (int i = 0, j = 0; i < numTasks; i++) {
+		memcpy(pairings + *size, ranges[i].pairings, ranges[i].size * sizeof(Pairing));
+		*size += ranges[i].size;
+		free(ranges[i].pairings);
+		// a split group's leftovers go after its last chunk
+		if (j < numSplit && ranges[i].last == split[j].last) {
+			memcpy(pairings + *size, split[j].pairings, split[j].size * sizeof(Pairing));
+			*size += split[j].size;
+			free(split[j++].pairings);
 		}
-	printf("\n");
-	
-	return;
+	}
+
+	free(ranges);
+	free(split);
+	free(tasks);
+	return pairings;
+}
+
+
+void pairRange(void *arg)
+{
+	TRACE_SCOPE_ARG("pairRange", ((PairingTask *)arg)->first);
+	PairingTask *range = arg;
+
+	// every pairing takes two players, so this is as many as there can be
+	range->pairings = malloc(((range->last - range->first) / 2 + 1) * sizeof(Pairing));
+	range->size = 0;
+	for (int player = range->first; player < range->last - 1; player++)
+		matchPlayer(range->roster, range->pairings, &range->size, player, range->last);
+}
+
+
+// sorts the biggest tasks first
+int compareTasks(const void *task1, const void *task2)
+{
+	const PairingTask *range1 = ((const Task *)task1)->arg, *range2 = ((const Task *)task2)->arg;
+
+	if (range1->last - range1->first != range2->last - range2->first)
+		return (range2->last - range2->first) - (range1->last - range1->first);
+	return range1->first - range2->first;
 }
 
 
-Pairing *matchPlayer(Pairing *pairings, int *size, int p1Idx)
+// pairs roster[p1Idx] with the first player after them (up to last) that they
+// can be paired with, if there is one. The roster has to be sorted by score
+void matchPlayer(Player *roster, Pairing *pairings, int *size, int p1Idx, int last)
 {
-	float startTime = 0.0, endTime = 0.0;
-	const float minHourDif = (float)minTimeDif / (float)MINUTES_IN_HOUR;
+	int startTime, endTime;
+
+	for (int search = p1Idx + 1; search < last && !roster[p1Idx].paired; search++) {
+		// they're ordered by score, so nobody after this is close enough either
+		if (roster[p1Idx].score - maxPointDif > roster[search].score)
+			break;
 
-	for (int search = p1Idx + 1; search < totalPlayers; search++) {
-		
 		/* if:
 		 * - both players aren't paired
 		 * - the score gap is small enough
 		 * - the players haven't fought before
+		 * - the players' times could overlap for long enough
 		 * pair the players
 		 */
-		if ((players[p1Idx].paired | players[search].paired)
+		if ((roster[p1Idx].paired | roster[search].paired)
 				// they're ordered by score so p1 will have a higher or equal to score than p2
-				|| players[p1Idx].score - maxPointDif > players[search].score
-				|| haveFought(players[p1Idx], players[search]))
+				|| roster[p1Idx].score - maxPointDif > roster[search].score
+				|| haveFought(roster[p1Idx], roster[search])
+				|| !canOverlap(&roster[p1Idx], &roster[search]))
 			continue;
 
-		while (getNextRange(players[p1Idx].times[dayOfWeek],
-					players[search].times[dayOfWeek],
-					&startTime, &endTime))
-			if (pairPlayer(pairings, size, p1Idx, search, startTime, endTime, minHourDif))
+		startTime = endTime = 0;
+		while (getNextRange(&roster[p1Idx], &roster[search], dayOfWeek, &startTime, &endTime))
+			if (pairPlayer(pairings, size, &roster[p1Idx], &roster[search], startTime, endTime))
 				break;
 	}
-
-	return pairings;
 }
 
 
-int pairPlayer(Pairing *pairings, int *size, int p1Idx, int search, float startTime, float endTime, float minHourDif)
+int pairPlayer(Pairing *pairings, int *size, Player *p1, Player *p2, int startTime, int endTime)
 {
+	int isEarliest = 0;
+
+	// no match can start before the earliest time
+	startTime = MAX(startTime, earliestTime);
+
 	// if the previous match's time is equal to the proposed start time of this one,
 	// buffer it by the minimum amount of time a match needs
 	// TODO: this is outdated. Rework.
-	if (pairings[*size - 1].time == startTime)
-		startTime += minHourDif;
+	if (*size > 0 && pairings[*size - 1].time == startTime) {
+		startTime += minTimeDif;
+		isEarliest = 1;
+	}
 	
-	if (startTime > endTime - minHourDif)
+	if (startTime > endTime - minTimeDif)
 		return 0;
 
 	// if the longest time that a match can last is big enough
-	if (startTime <= endTime - minHourDif) {
-		addPairedPlayer(&players[p1Idx], &players[search]);
-		players[p1Idx].paired = players[search].paired = 1;
+	if (startTime <= endTime - minTimeDif) {
+		addPairedPlayer(p1, p2);
+		p1->paired = p2->paired = 1;
 
-		pairings = realloc(pairings, ++*size * sizeof(Pairing));
-		pairings[*size - 1].p1 = &players[p1Idx];
-		pairings[*size - 1].p2 = &players[search];
-		pairings[*size - 1].time = startTime;
+		pairings[*size].p1 = p1;
+		pairings[*size].p2 = p2;
+		pairings[*size].time = startTime;
+		pairings[(*size)++].isEarliest = isEarliest;
 
 		return 1;
 	}
@@ -284,132 +627,363 @@ int pairPlayer(Pairing *pairings, int *size, int p1Idx, int search, float startT
 }
 
 
-void addPairedPlayer(Player *player1, Player *player2)
+// pairs the players at the first time that works for both of them.
+// Returns 1 if there was one; 0 otherwise
+int schedulePair(Pairing *pairings, int *size, Player *p1, Player *p2)
 {
-	if (player1->prevPlayedNum == 0)
-		player1->prevPlayed = malloc(++(player1->prevPlayedNum));
-	else
-		player1->prevPlayed = realloc(player1->prevPlayed, ++(player1->prevPlayedNum));
-	player1->prevPlayed[player1->prevPlayedNum - 1] = player2->id;
+	int startTime = 0, endTime = 0;
+
+	while (getNextRange(p1, p2, dayOfWeek, &startTime, &endTime))
+		if (pairPlayer(pairings, size, p1, p2, startTime, endTime))
+			return 1;
+	return 0;
+}
+
 
-	if (player2->prevPlayedNum == 0)
-		player2->prevPlayed = malloc(++(player2->prevPlayedNum));
-	else
-		player2->prevPlayed = realloc(player2->prevPlayed, ++(player2->prevPlayedNum));
-	player2->prevPlayed[player2->prevPlayedNum - 1] = player1->id;
+// schedules a pair that's already been chosen, so they're known to both be
+// free for long enough. If staggering it from the match before leaves no time
+// for it, it starts a new run of matches, where there's nothing before it to
+// stagger from
+void placePair(Pairing *pairings, int *size, Player *p1, Player *p2)
+{
+	int isFirst = 0;
+
+	if (!schedulePair(pairings, size, p1, p2)) {
+		schedulePair(pairings + *size, &isFirst, p1, p2);
+		(*size)++;
+	}
+}
+
+
+void addPairedPlayer(Player *player1, Player *player2)
+{
+	addPrevPlayed(player1, player2->id);
+	addPrevPlayed(player2, player1->id);
 
 	return;
 }
 
 
+// the history is only ever rolled back, never freed, until the roster is, so
+// it only needs reallocating once it's outgrown what it's been given
+void addPrevPlayed(Player *player, int id)
+{
+	if (player->prevPlayedNum == player->prevPlayedCap) {
+		player->prevPlayedCap = MAX(2 * player->prevPlayedCap, 4);
+		player->prevPlayed = realloc(player->prevPlayed, player->prevPlayedCap * sizeof(int));
+	}
+	player->prevPlayed[player->prevPlayedNum++] = id;
+}
+
+
+// the JSON output is a single object, so it needs opening and closing
+void beginOutput()
+{
+	if (outputFormat == FORMAT_JSON)
+		emitChar('{');
+}
+
+
+void endOutput()
+{
+	if (outputFormat == FORMAT_JSON)
+		emitString("}\n");
+	flushOutput();
+}
+
+
 void printPlayers()
 {
+	if (isQuiet)
+		return;
+
+	if (outputFormat == FORMAT_JSON)
+		emitString("\"players\":[");
 	for (int i = 0; i < totalPlayers; i++) {
-		printf("%*s   %.1f", -longestName, players[i].name, players[i].score);
-		if (isVisual)
-			printTimes(players[i]);
-		printf("\n");
+		switch (outputFormat) {
+			case FORMAT_TEXT:
+				emitPadded(players[i].name, -longestName);
+				emitString("   ");
+				emitScore(players[i].score);
+				if (isVisual)
+					printTimes(players[i]);
+				emitChar('\n');
+				break;
+
+			case FORMAT_CSV:
+				emitString("player,");
+				emitInt(players[i].id);
+				emitChar(',');
+				emitString(players[i].name);
+				emitChar(',');
+				emitScore(players[i].score);
+				emitChar('\n');
+				break;
+
+			case FORMAT_JSON:
+				if (i != 0)
+					emitChar(',');
+				printJSONPlayer(&players[i]);
+				break;
+		}
 	}
-	printf("\n");
+	if (outputFormat == FORMAT_JSON)
+		emitString("],");
+	if (outputFormat == FORMAT_TEXT)
+		emitChar('\n');
 }
 
 
 void printTimes(Player player)
 {
-	// TODO: print the times graphically
-	
+	int startTime = 0, endTime = 0;
 	int count = 0;
-	for (int hour = 0; hour < 24; hour++) {
-		int minute;
-		uint64_t boundaries = player.times[dayOfWeek][hour] & (player.times[dayOfWeek][hour] << 1);
-		while ((minute = BSF(boundaries)) != -1) {
-			count++;
-			boundaries ^= 1ull << minute;
-			if (count == 0)
-				printf("   ");
-			else if (count % 2 == 0)
-				printf(", ");
-			else
-				printf(" - ");
-			printTime(stdout, hour, minute);
-		}
+
+	// the ranges a player is available for are the ones they share with themselves
+	while (getNextRange(&player, &player, dayOfWeek, &startTime, &endTime)) {
+		emitString(count++ == 0 ? "   " : ", ");
+		emitTime(startTime);
+		emitString(" - ");
+		emitTime(endTime);
 	}
 }
 
 
 void printPairings(Pairing *pairings, int size)
 {
-	int hours, minutes;
+	TRACE_SCOPE("printPairings");
+	beginPairings();
+	for (int match = 0; match < size; match++)
+		printPairing(&pairings[match], match == 0);
+	endPairings();
+	printPairingIDs(pairings, size);
+}
+
+
+void beginPairings()
+{
+	if (outputFormat == FORMAT_JSON)
+		emitString("\"pairings\":[");
+}
+
+
+void printPairing(Pairing *pairing, int isFirst)
+{
+	switch (outputFormat) {
+		case FORMAT_TEXT:
+			emitTime(pairing->time);
+			emitString(": ");
+			emitPadded(pairing->p1->name, -longestName);
+			emitString(" - ");
+			emitPadded(pairing->p2->name, -longestName);
+			// if the earliest time the match _can_ take place is earlier than
+			// the time it's actually taking place, it means that there's a match
+			// taking its slot - meaning if other match finishes early, this one
+			// can be moved
+			if (pairing->isEarliest)
+				emitString("[Can change]");
+			emitChar('\n');
+			break;
+
+		case FORMAT_CSV:
+			emitString("pairing,");
+			emitTime(pairing->time);
+			emitChar(',');
+			emitInt(pairing->p1->id);
+			emitChar(',');
+			emitString(pairing->p1->name);
+			emitChar(',');
+			emitInt(pairing->p2->id);
+			emitChar(',');
+			emitString(pairing->p2->name);
+			emitChar(',');
+			emitChar(TOCHAR(pairing->isEarliest));
+			emitChar('\n');
+			break;
+
+		case FORMAT_JSON:
+			if (!isFirst)
+				emitChar(',');
+			emitString("{\"time\":\"");
+			emitTime(pairing->time);
+			emitString("\",\"p1\":");
+			printJSONPlayer(pairing->p1);
+			emitString(",\"p2\":");
+			printJSONPlayer(pairing->p2);
+			emitString(",\"canChange\":");
+			emitString(pairing->isEarliest ? "true}" : "false}");
+			break;
+	}
+}
+
+
+void endPairings()
+{
+	if (outputFormat == FORMAT_JSON)
+		emitString("],");
+}
+
 
+// the text format lists the pairings' IDs after all of the pairings
+void printPairingIDs(Pairing *pairings, int size)
+{
+	if (outputFormat != FORMAT_TEXT || isQuiet)
+		return;
 	for (int match = 0; match < size; match++) {
-		hours = pairings[match].time;
-		minutes = (pairings[match].time - (int)(pairings[match].time)) * 60.0;
-
-		// it must have 2 digits, even if the first is 0
-		printTime(stdout, hours, minutes);
-		printf(": ");
-
-		printf("%*s - %*s", -longestName, pairings[match].p1->name,
-				-longestName, pairings[match].p2->name);
-		// if the earliest time the match _can_ take place is earlier than
-		// the time it's actually taking place, it means that there's a match
-		// taking its slot - meaning if other match finishes early, this one
-		// can be moved
-		if (pairings[match].isEarliest)
-			printf("[Can change]");
-		printf("\n");
+		emitString("id: ");
+		printPaddedID(pairings[match].p1->id);
+		emitString(" - id: ");
+		printPaddedID(pairings[match].p2->id);
+		emitChar('\n');
 	}
-	for (int match = 0; match < size; match++)
-		printf("id: %-2d - id: %-2d\n", pairings[match].p1->id, pairings[match].p2->id);
 }
 
 
-void printTime(FILE *stream, int hour, int minute)
+void printUnpaired()
 {
-	if (hour < 10)
-		fprintf(stream, "0");
-	fprintf(stream, "%d:", hour);
+	int remaining = unpairedPlayers;
+
+	switch (outputFormat) {
+		case FORMAT_TEXT:
+			emitString("Unpaired players: ");
+			if (remaining == 0) {
+				emitString("None\n");
+				return;
+			}
+			for (int i = 0; i < totalPlayers; i++)
+				if (players[i].paired == 0) {
+					emitString(players[i].name);
+					emitString(" (id: ");
+					emitInt(players[i].id);
+					emitChar(')');
+					if (--remaining > 0)
+						emitString(", ");
+				}
+			emitChar('\n');
+			break;
+
+		case FORMAT_CSV:
+			for (int i = 0; i < totalPlayers; i++)
+				if (players[i].paired == 0) {
+					emitString("unpaired,");
+					emitInt(players[i].id);
+					emitChar(',');
+					emitString(players[i].name);
+					emitChar('\n');
+				}
+			break;
 
-	if (minute < 10)
-		fprintf(stream, "0");
-	fprintf(stream, "%d: ", minute);
+		case FORMAT_JSON:
+			emitString("\"unpaired\":[");
+			for (int i = 0; i < totalPlayers; i++)
+				if (players[i].paired == 0) {
+					printJSONPlayer(&players[i]);
+					if (--remaining > 0)
+						emitChar(',');
+				}
+			emitString("],");
+			break;
+	}
 }
 
 
+// the text output already says everything the stats would
+void printStats(int pairings)
+{
+	switch (outputFormat) {
+		case FORMAT_CSV:
+			emitString("stats,");
+			emitInt(totalPlayers);
+			emitChar(',');
+			emitInt(pairings);
+			emitChar(',');
+			emitInt(unpairedPlayers);
+			emitChar('\n');
+			break;
+
+		case FORMAT_JSON:
+			emitString("\"stats\":{\"players\":");
+			emitInt(totalPlayers);
+			emitString(",\"pairings\":");
+			emitInt(pairings);
+			emitString(",\"unpaired\":");
+			emitInt(unpairedPlayers);
+			emitChar('}');
+			break;
+	}
+}
+
+
+// names can only be alphanumeric, so they never need escaping
+void printJSONPlayer(Player *player)
+{
+	emitString("{\"id\":");
+	emitInt(player->id);
+	emitString(",\"name\":\"");
+	emitString(player->name);
+	emitString("\",\"score\":");
+	emitScore(player->score);
+	emitChar('}');
+}
+
+
+// the same as printf's "%-2d"
+void printPaddedID(int id)
+{
+	emitInt(id);
+	if (id >= 0 && id < 10)
+		emitChar(' ');
+}
+
+
+// a counting sort: each score is a bucket, and the players go into their buckets
+// in order, so players with the same score stay in the order of the file
 void sortPlayers()
 {
-	// bubble sort for simplicity's sake
-	for (int i = 1; i < totalPlayers; i++)
-		for (int j = 0; j < totalPlayers - 1; j++)
-			// sort by score
-			if (players[j].score < players[j + 1].score) {
-				swap(&players[j], &players[j + 1]);
-			// if the scores are the same, sort by earliest start time first
-			} else if (players[j].score == players[j + 1].score) {
-				if (players[j].times[0] > players[j + 1].times[0])
-					swap(&players[j], &players[j + 1]);
-				// if earliest time is the same, sort by earliest finish time first
-				if (players[j].times[0] == players[j + 1].times[0]
-						&& players[j].times[1] > players[j + 1].times[1])
-					swap(&players[j], &players[j + 1]);
-			}
+	TRACE_SCOPE("sortPlayers");
+	int maxScore = 0;
+	int *counts;
+
+	for (int i = 0; i < totalPlayers; i++)
+		maxScore = MAX(maxScore, players[i].score);
+	counts = calloc(maxScore + 1, sizeof(int));
+	for (int i = 0; i < totalPlayers; i++)
+		counts[players[i].score]++;
+
+	bucketPlayers(counts, maxScore);
+	free(counts);
+}
+
+
+// sorts the players by score, highest first, given how many players have each
+// score from 0 to maxScore
+void bucketPlayers(int *counts, int maxScore)
+{
+	Player *sorted = malloc((totalPlayers + 1) * sizeof(Player));
+	// where the next player with each score goes
+	int *next = malloc((maxScore + 1) * sizeof(int));
+
+	for (int score = maxScore, total = 0; score >= 0; score--) {
+		next[score] = total;
+		total += counts[score];
+	}
+	for (int i = 0; i < totalPlayers; i++)
+		sorted[next[players[i].score]++] = players[i];
+
+	free(players);
+	players = sorted;
+	free(next);
 }
 
 
-char *ttot(float timeFloat)
+char *ttot(int time)
 {
-	int minutes = (timeFloat - (int)timeFloat) * 60;
+	int hours = time / MINUTES_IN_HOUR, minutes = time % MINUTES_IN_HOUR;
 
-	if (timeFloat < 10.0)
-		token[0] = '0';
-	else
-		token[0] = TOCHAR((int)(timeFloat / 10.0));
-	token[1] = TOCHAR((int)timeFloat % 10);
+	token[0] = TOCHAR(hours / 10);
+	token[1] = TOCHAR(hours % 10);
 	token[2] = ':';
-	if (minutes < 10)
-		token[3] = '0';
-	else
-		token[3] = TOCHAR(minutes / 10);
+	token[3] = TOCHAR(minutes / 10);
 	token[4] = TOCHAR(minutes % 10);
 	token[5] = '\0';
 	
@@ -417,29 +991,29 @@ char *ttot(float timeFloat)
 }
 
 
-void swap(Player *player1, Player *player2)
+void freePlayerList()
 {
-	Player temp = *player1;
-	*player1 = *player2;
-	*player2 = temp;
+	for (int i = 0; i < totalPlayers; i++)
+		freePlayer(&players[i]);
+	free(players);
 }
 
 
-void freePlayerList()
+void freePlayer(Player *player)
 {
-	for (int i = 0; i < totalPlayers; i++) {
-		free(players[i].name);
-		free(players[i].prevPlayed);
-		free(players[i].comment);
-	}
-	free(players);
+	free(player->name);
+	free(player->prevPlayed);
+	free(player->comment);
+	free(player->times);
+	free(player->ranges);
 }
 
 
 int haveFought(Player p1, Player p2)
 {
-	if (p1.prevPlayedNum == 0)
-		return 0;
+	// players from other events don't show up in this roster's history
+	if (archiveHasFought(p1.id, p2.id))
+		return 1;
 
 	// we only check one of the players because if p1 hasn't played p2,
 	// p2 hasn't played p1 either
@@ -449,3 +1023,37 @@ int haveFought(Player p1, Player p2)
 	
 	return 0;
 }
+
+
+// returns 1 if the players can be paired against each other at some time on
+// the day, ignoring any other matches; 0 otherwise
+int canPair(Player *p1, Player *p2)
+{
+	int startTime = 0, endTime = 0;
+
+	if (abs(p1->score - p2->score) > maxPointDif
+			|| haveFought(*p1, *p2)
+			|| !canOverlap(p1, p2))
+		return 0;
+
+	while (getNextRange(p1, p2, dayOfWeek, &startTime, &endTime))
+		if (MAX(startTime, earliestTime) <= endTime - minTimeDif)
+			return 1;
+	return 0;
+}
+
+
+// a cheap test on the players' summaries that rules out most pairs before
+// their minutes have to be compared. Returns 1 if the players' times for the
+// day _could_ overlap for long enough for a match, 0 if they definitely can't
+int canOverlap(Player *p1, Player *p2)
+{
+	if (!((p1->dayMask & p2->dayMask) >> dayOfWeek & 1))
+		return 0;
+	if (!(p1->hourMask[dayOfWeek] & p2->hourMask[dayOfWeek]))
+		return 0;
+	// neither player has a run of minutes long enough for a match
+	if (MIN(p1->longestRun[dayOfWeek], p2->longestRun[dayOfWeek]) < minTimeDif)
+		return 0;
+	return 1;
+}
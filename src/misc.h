@@ -6,21 +6,74 @@
 #define MINUTES_IN_HOUR       60
 #define HOURS_IN_DAY          24
 #define DAYS_IN_WEEK          7
+#define MINUTES_IN_DAY        (HOURS_IN_DAY * MINUTES_IN_HOUR)
+#define WORD_BITS             64
+
+// the length of one slot of time, in minutes. Matches can only start on slot
+// boundaries, so the coarser the slots, the fewer words a day takes up.
+// Set it at build time with "make SLOT_MINUTES=15"
+#ifndef SLOT_MINUTES
+#define SLOT_MINUTES          1
+#endif
+#if SLOT_MINUTES != 1 && SLOT_MINUTES != 5 && SLOT_MINUTES != 15 && SLOT_MINUTES != 30
+#error "SLOT_MINUTES must be 1, 5, 15 or 30"
+#endif
+#define SLOTS_IN_HOUR         (MINUTES_IN_HOUR / SLOT_MINUTES)
+#define SLOTS_IN_DAY          (HOURS_IN_DAY * SLOTS_IN_HOUR)
+#define WORDS_IN_DAY          ((SLOTS_IN_DAY + WORD_BITS - 1) / WORD_BITS)
 #define MAXLINE               1000
 
+// a range of slots of a day, from start (inclusive) to end (exclusive)
+typedef struct {
+	uint16_t start, end;
+} TimeRange;
+
 typedef struct {
     int id;
 	char* name;
 	int prevPlayedNum;
+	// how many opponents prevPlayed has room for
+	int prevPlayedCap;
 	int *prevPlayed;
-	float score;
-	// this represents the times they're available for each minute of the day.
-	// 1 bit is 1 minute
-	uint64_t times[DAYS_IN_WEEK][HOURS_IN_DAY];
+	// in half points, so 1.5 is stored as 3
+	int score;
+	// this represents the times they're available for each slot of the day.
+	// 1 bit is 1 slot, and slot n of a day is bit n % WORD_BITS of word n / WORD_BITS.
+	// Players with only a few ranges have this set to NULL and use ranges instead
+	uint64_t (*times)[WORDS_IN_DAY];
+	// every range they're available for, sorted by day, then by start time.
+	// Day n's ranges go from ranges[rangeStart[n]] up to ranges[rangeStart[n + 1]]
+	TimeRange *ranges;
+	uint16_t rangeStart[DAYS_IN_WEEK + 1];
+	// coarse summaries of the times, built once they've been read in, so
+	// most incompatible pairs can be rejected without looking at the minutes:
+	// bit n of hourMask[day] is set if any minute of hour n is available,
+	// bit n of dayMask is set if any minute of day n is available and
+	// longestRun[day] is the longest unbroken run of minutes in that day
+	uint32_t hourMask[DAYS_IN_WEEK];
+	uint8_t dayMask;
+	int longestRun[DAYS_IN_WEEK];
 	unsigned int paired : 1;
+	// the rest of the line after the times. In low memory mode, this is
+	// NULL and only where it is in the roster file is kept
 	char *comment;
+	long commentOffset;
+	int commentLength;
+	// which line of the roster the player is on, where in the file that
+	// line starts, and a hash of it. These are only kept up to date in watch mode
+	int line;
+	long lineStart;
+	uint64_t lineHash;
 } Player;
 
+typedef struct {
+	// player 1, player 2
+	Player *p1, *p2;
+	// in minutes since midnight
+	int time;
+	unsigned int isEarliest : 1;
+} Pairing;
+
 enum tokens {
 	C_START_BRACKET,
 	C_END_BRACKET,
@@ -34,6 +87,18 @@ enum tokens {
 	UNDEFINED,
 };
 
+enum modes {
+	MODE_GREEDY,
+	MODE_DUTCH,
+	MODE_CONSTRAINED,
+};
+
+enum formats {
+	FORMAT_TEXT,
+	FORMAT_CSV,
+	FORMAT_JSON,
+};
+
 enum errors {
 	// starting at 1 because an axit code of 0 is no error
 	EXPECTED_COLON = 01,
@@ -0,0 +1,125 @@
+/* A small buffered emitter for everything that goes to stdout. The pairings
+ * for a big roster are hundreds of thousands of tiny writes, and going through
+ * printf for each of them costs more than the pairing itself, so they're
+ * collected here and written out in large blocks instead.
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "output.h"
+#include "util.h"
+
+// each thread has its own buffer, so batch mode's sections don't get mixed up
+static _Thread_local char buffer[OUTPUT_BUFFER];
+static _Thread_local int bufferLength;
+// where this thread's output goes. NULL is stdout
+_Thread_local FILE *outputStream;
+
+
+void emitChar(char c)
+{
+	if (bufferLength == OUTPUT_BUFFER)
+		flushOutput();
+	buffer[bufferLength++] = c;
+}
+
+
+void emitString(const char *str)
+{
+	int length = strlen(str);
+
+	// if it'll never fit, don't bother copying it
+	if (length > OUTPUT_BUFFER) {
+		flushOutput();
+		fwrite(str, 1, length, outputStream != NULL ? outputStream : stdout);
+		return;
+	}
+	if (bufferLength + length > OUTPUT_BUFFER)
+		flushOutput();
+	memcpy(buffer + bufferLength, str, length);
+	bufferLength += length;
+}
+
+
+// like printf's "%*s": a negative width pads on the right, a positive one on the left
+void emitPadded(const char *str, int width)
+{
+	int padding = (width < 0 ? -width : width) - (int)strlen(str);
+
+	if (width > 0)
+		while (padding-- > 0)
+			emitChar(' ');
+	emitString(str);
+	while (padding-- > 0)
+		emitChar(' ');
+}
+
+
+// a string inside a JSON string's quotes, with anything JSON won't take as it
+// is escaped
+void emitJSONString(const char *str)
+{
+	for (; *str != '\0'; str++) {
+		unsigned char c = *str;
+
+		if (c == '"' || c == '\\') {
+			emitChar('\\');
+			emitChar(c);
+		} else if (c < 0x20) {
+			emitString("\\u00");
+			emitChar("0123456789abcdef"[c >> 4]);
+			emitChar("0123456789abcdef"[c & 15]);
+		} else {
+			emitChar(c);
+		}
+	}
+}
+
+
+void emitInt(int num)
+{
+	// enough for every digit of a 32-bit int and a sign
+	char digits[12];
+	int i = sizeof(digits);
+	unsigned int magnitude = num < 0 ? -(unsigned int)num : (unsigned int)num;
+
+	do {
+		digits[--i] = TOCHAR(magnitude % 10);
+		magnitude /= 10;
+	} while (magnitude != 0);
+	if (num < 0)
+		digits[--i] = '-';
+
+	while (i < sizeof(digits))
+		emitChar(digits[i++]);
+}
+
+
+// scores are in half points, so they're printed with 1 decimal
+void emitScore(int score)
+{
+	emitInt(score / 2);
+	emitChar('.');
+	emitChar(score % 2 ? '5' : '0');
+}
+
+
+// prints a time in minutes since midnight as "HH:MM"
+void emitTime(int time)
+{
+	int hour = time / MINUTES_IN_HOUR, minute = time % MINUTES_IN_HOUR;
+
+	emitChar(TOCHAR(hour / 10));
+	emitChar(TOCHAR(hour % 10));
+	emitChar(':');
+	emitChar(TOCHAR(minute / 10));
+	emitChar(TOCHAR(minute % 10));
+}
+
+
+void flushOutput()
+{
+	fwrite(buffer, 1, bufferLength, outputStream != NULL ? outputStream : stdout);
+	fflush(outputStream != NULL ? outputStream : stdout);
+	bufferLength = 0;
+}
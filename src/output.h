@@ -0,0 +1,24 @@
+#include <stdio.h>
+
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+// how many bytes are collected before they're written out in one go
+#define OUTPUT_BUFFER         (1 << 16)
+
+void emitChar(char c);
+void emitString(const char *str);
+void emitPadded(const char *str, int width);
+void emitJSONString(const char *str);
+void emitInt(int num);
+void emitScore(int score);
+void emitTime(int time);
+void flushOutput(void);
+void beginOutput(void);
+void endOutput(void);
+
+// one of enum formats
+extern int outputFormat;
+extern _Thread_local FILE *outputStream;
+
+#endif
@@ -0,0 +1,53 @@
+#include "misc.h"
+
+#ifndef PAIRING_H
+#define PAIRING_H
+
+// the most threads any stage will start
+#define MAX_THREADS           64
+// score groups with more players than this are paired in chunks of this size
+// first, then the leftovers are paired across the whole group
+#define GROUP_CHUNK           1024
+
+// a contiguous range of players that can be paired without looking at anyone else
+typedef struct {
+	Player *roster;
+	// from first (inclusive) to last (exclusive)
+	int first, last;
+	Pairing *pairings;
+	int size;
+} PairingTask;
+
+void pairRange(void *arg);
+void matchPlayer(Player *roster, Pairing *pairings, int *size, int p1Idx, int last);
+// pairings has to have room for one more pairing.
+// returns 1 if successful; 0 otherwise
+int pairPlayer(Pairing *pairings, int *size, Player *p1, Player *p2, int startTime, int endTime);
+int schedulePair(Pairing *pairings, int *size, Player *p1, Player *p2);
+void placePair(Pairing *pairings, int *size, Player *p1, Player *p2);
+void addPairedPlayer(Player *player1, Player *player2);
+void addPrevPlayed(Player *player, int id);
+int haveFought(Player p1, Player p2);
+int canOverlap(Player *p1, Player *p2);
+int canPair(Player *p1, Player *p2);
+void improvePairings(Pairing **pairings, int *size);
+void publishPairings(void);
+void pairPlayers(void);
+// returns the number of arguments used after arg
+int handleArg(char *arg, char *nextArg);
+int parseDay(char *day);
+int parseMode(char *mode);
+void printPlayers(void);
+void beginPairings(void);
+void printPairing(Pairing *pairing, int isFirst);
+void endPairings(void);
+void printPairingIDs(Pairing *pairings, int size);
+void printPairings(Pairing *pairings, int size);
+void printUnpaired(void);
+void printStats(int pairings);
+
+extern int maxPointDif, earliestTime, minTimeDif;
+extern int budgetMs, numThreads, pairingMode;
+extern _Thread_local int unpairedPlayers;
+
+#endif
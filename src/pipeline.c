@@ -0,0 +1,295 @@
+/* Pipelined mode: rather than reading, sorting, pairing and writing one after
+ * the other, the stages run at the same time wherever they can.
+ *
+ * - One thread reads the roster in big chunks of whole lines, while this
+ *   thread parses the chunks it's already read and counts how many players
+ *   have each score, so sorting them afterwards is a single pass.
+ * - Then one thread pairs the score groups in order, handing each one over as
+ *   soon as it's done, while this thread prints the roster and then every
+ *   group's pairings as they come in.
+ *
+ * Both handovers go through a bounded queue, so neither side can run too far
+ * ahead of the other. The output is exactly the same as without -P.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "pipeline.h"
+#include "files.h"
+#include "pairing.h"
+#include "pool.h"
+#include "output.h"
+#include "exact.h"
+#include "util.h"
+
+// if set, the stages are pipelined
+int isPipelined;
+
+typedef struct {
+	char *text;
+	long length;
+	// where the chunk starts in the roster file
+	long offset;
+} Chunk;
+
+typedef struct {
+	FILE *file;
+	Queue *chunks;
+} Reader;
+
+typedef struct {
+	Player *players;
+	int totalPlayers;
+	Queue *groups;
+} Pairer;
+
+static void loadPlayers(void);
+static void *readChunks(void *arg);
+static void *pairScoreGroups(void *arg);
+static Pairing *pairGroup(int first, int last, int *size);
+
+
+void runPipeline()
+{
+	pthread_t thread;
+	Queue groups;
+	Pairer pairer;
+	PairingTask *group;
+	PairingTask **done = NULL;
+	int numDone = 0, size = 0;
+
+	loadPlayers();
+
+	// improving the pairings can change any of them at the end, so there's
+	// nothing to print until it's finished. Only greedy pairing is done a
+	// group at a time: the other modes, and small rosters, are paired all at once
+	if (budgetMs > 0 || pairingMode != MODE_GREEDY || totalPlayers <= EXACT_PLAYERS) {
+		publishPairings();
+		return;
+	}
+
+	initQueue(&groups, GROUP_QUEUE);
+	pairer.players = players;
+	pairer.totalPlayers = totalPlayers;
+	pairer.groups = &groups;
+	pthread_create(&thread, NULL, pairScoreGroups, &pairer);
+
+	beginOutput();
+	printPlayers();
+	beginPairings();
+	while ((group = popQueue(&groups)) != NULL) {
+		for (int match = 0; match < group->size; match++)
+			printPairing(&group->pairings[match], size + match == 0);
+		size += group->size;
+		done = realloc(done, (numDone + 1) * sizeof(PairingTask *));
+		done[numDone++] = group;
+	}
+	pthread_join(thread, NULL);
+	destroyQueue(&groups);
+	endPairings();
+	for (int i = 0; i < numDone; i++)
+		printPairingIDs(done[i]->pairings, done[i]->size);
+
+	unpairedPlayers = 0;
+	for (int player = 0; player < totalPlayers; player++)
+		if (players[player].paired == 0)
+			unpairedPlayers++;
+	printUnpaired();
+	printStats(size);
+	endOutput();
+	updateFile();
+
+	for (int i = 0; i < numDone; i++) {
+		free(done[i]->pairings);
+		free(done[i]);
+	}
+	free(done);
+}
+
+
+// does what readInPlayers and sortPlayers do, with the reading done on another thread
+static void loadPlayers()
+{
+	pthread_t thread;
+	Queue chunks;
+	Reader reader;
+	Chunk *chunk;
+	int capacity = 0, maxScore = 0;
+	// how many players have each score
+	int *counts = calloc(1, sizeof(int));
+	int c;
+
+	reader.file = fopen(playerFile, "r");
+	if (reader.file == NULL) {
+		fprintf(stderr, "ERROR: Couldn't open \"%s\"\n", playerFile);
+		exit(1);
+	}
+	initQueue(&chunks, CHUNK_QUEUE);
+	reader.chunks = &chunks;
+	pthread_create(&thread, NULL, readChunks, &reader);
+
+	players = NULL;
+	totalPlayers = 0;
+	while ((chunk = popQueue(&chunks)) != NULL) {
+		fp = fmemopen(chunk->text, chunk->length, "r");
+
+		while (1) {
+			// this skips over comments
+			while (getToken(fp) == HASHTAG)
+				while ((c = fgetc(fp)) != '\n' && c != EOF)
+					;
+			if (tokenType == EOF)
+				break;
+
+			if (totalPlayers == capacity) {
+				capacity = MAX(2 * capacity, 64);
+				players = realloc(players, capacity * sizeof(Player));
+			}
+			readPlayer(totalPlayers);
+			// the comment is somewhere in this chunk, not at the start of the file
+			players[totalPlayers].commentOffset += chunk->offset;
+
+			if (players[totalPlayers].score > maxScore) {
+				counts = realloc(counts, (players[totalPlayers].score + 1) * sizeof(int));
+				memset(counts + maxScore + 1, 0, (players[totalPlayers].score - maxScore) * sizeof(int));
+				maxScore = players[totalPlayers].score;
+			}
+			counts[players[totalPlayers++].score]++;
+		}
+
+		fclose(fp);
+		free(chunk->text);
+		free(chunk);
+	}
+	pthread_join(thread, NULL);
+	destroyQueue(&chunks);
+
+	// the highest ID is one fewer than the number of players
+	longestPlayerID = numLength(totalPlayers - 1);
+	bucketPlayers(counts, maxScore);
+	free(counts);
+}
+
+
+// reads the roster in chunks that end at the end of a line, so no player is
+// ever split between two chunks
+static void *readChunks(void *arg)
+{
+	Reader *reader = arg;
+	// the part of the last read that's after its last full line
+	char *leftover = NULL;
+	long leftoverLength = 0, offset = 0;
+
+	while (1) {
+		Chunk *chunk = malloc(sizeof(Chunk));
+		long size = leftoverLength + CHUNK_SIZE, length = leftoverLength, end;
+		int isEnd = 0;
+
+		chunk->text = malloc(size);
+		if (leftoverLength > 0)
+			memcpy(chunk->text, leftover, leftoverLength);
+		free(leftover);
+		leftover = NULL;
+
+		// keep going until there's a full line, however long it is
+		while (1) {
+			long numRead = fread(chunk->text + length, 1, size - length, reader->file);
+			length += numRead;
+			if (numRead == 0) {
+				isEnd = 1;
+				break;
+			}
+			if (memchr(chunk->text + length - numRead, '\n', numRead) != NULL)
+				break;
+			chunk->text = realloc(chunk->text, size *= 2);
+		}
+
+		for (end = length; !isEnd && chunk->text[end - 1] != '\n'; end--)
+			;
+		leftoverLength = length - end;
+		if (leftoverLength > 0) {
+			leftover = malloc(leftoverLength);
+			memcpy(leftover, chunk->text + end, leftoverLength);
+		}
+
+		chunk->length = end;
+		chunk->offset = offset;
+		offset += end;
+		if (end > 0)
+			pushQueue(reader->chunks, chunk);
+		else {
+			free(chunk->text);
+			free(chunk);
+		}
+		if (isEnd)
+			break;
+	}
+
+	fclose(reader->file);
+	pushQueue(reader->chunks, NULL);
+	return NULL;
+}
+
+
+// pairs each score group in order, handing each one over as it's finished
+static void *pairScoreGroups(void *arg)
+{
+	Pairer *pairer = arg;
+
+	players = pairer->players;
+	totalPlayers = pairer->totalPlayers;
+
+	for (int first = 0, last = 1; first < totalPlayers; first = last++) {
+		PairingTask *group = malloc(sizeof(PairingTask));
+
+		while (last < totalPlayers && players[last - 1].score - players[last].score <= maxPointDif)
+			last++;
+		group->roster = players;
+		group->first = first;
+		group->last = last;
+		group->pairings = pairGroup(first, last, &group->size);
+		pushQueue(pairer->groups, group);
+	}
+
+	pushQueue(pairer->groups, NULL);
+	return NULL;
+}
+
+
+// pairs one score group the same way pairGroups does: in chunks on the pool
+// if it's big, then the leftovers across the whole group
+static Pairing *pairGroup(int first, int last, int *size)
+{
+	int numChunks = (last - first + GROUP_CHUNK - 1) / GROUP_CHUNK;
+	PairingTask *ranges = malloc((numChunks + 1) * sizeof(PairingTask));
+	Task *tasks = malloc((numChunks + 1) * sizeof(Task));
+	Pairing *pairings = malloc(((last - first) / 2 + 1) * sizeof(Pairing));
+
+	for (int i = 0; i < numChunks; i++) {
+		ranges[i].roster = players;
+		ranges[i].first = first + i * GROUP_CHUNK;
+		ranges[i].last = MIN(first + (i + 1) * GROUP_CHUNK, last);
+		tasks[i].run = pairRange;
+		tasks[i].arg = &ranges[i];
+	}
+	runTasks(tasks, numChunks, numThreads);
+	if (numChunks > 1) {
+		ranges[numChunks].roster = players;
+		ranges[numChunks].first = first;
+		ranges[numChunks].last = last;
+		pairRange(&ranges[numChunks++]);
+	}
+
+	*size = 0;
+	for (int i = 0; i < numChunks; i++) {
+		memcpy(pairings + *size, ranges[i].pairings, ranges[i].size * sizeof(Pairing));
+		*size += ranges[i].size;
+		free(ranges[i].pairings);
+	}
+
+	free(ranges);
+	free(tasks);
+	return pairings;
+}
@@ -0,0 +1,15 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+// how much of the roster is read at a time
+#define CHUNK_SIZE            (1 << 20)
+// how many chunks can be read ahead of the parsing
+#define CHUNK_QUEUE           4
+// how many score groups can be paired ahead of the output
+#define GROUP_QUEUE           64
+
+void runPipeline(void);
+
+extern int isPipelined;
+
+#endif
@@ -0,0 +1,162 @@
+/* A small work-stealing thread pool. Every task is known before any of them
+ * start, so they're dealt out to the threads' deques up front. Each thread
+ * works from the bottom of its own deque, and once that's empty it steals
+ * from the top of the others', so one huge task doesn't leave the other
+ * threads idle behind it.
+ * There's also a bounded queue, for one thread to hand work on to another.
+ */
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "pool.h"
+#include "pairing.h"
+#include "util.h"
+
+typedef struct {
+	pthread_mutex_t lock;
+	// indices into the tasks, from top (inclusive) to bottom (exclusive)
+	int *tasks;
+	int top, bottom;
+} Deque;
+
+typedef struct {
+	Task *tasks;
+	Deque *deques;
+	int numDeques;
+	int self;
+} Worker;
+
+static void *work(void *arg);
+static int popBottom(Deque *deque);
+static int stealTop(Deque *deque);
+
+
+// runs every task, then returns once they've all finished
+void runTasks(Task *tasks, int numTasks, int numThreads)
+{
+	pthread_t threads[MAX_THREADS];
+	Worker workers[MAX_THREADS];
+	Deque deques[MAX_THREADS];
+
+	numThreads = MAX(MIN(MIN(numThreads, numTasks), MAX_THREADS), 1);
+
+	// round-robin, so each thread gets a mix of the early and late tasks
+	for (int i = 0; i < numThreads; i++) {
+		pthread_mutex_init(&deques[i].lock, NULL);
+		deques[i].tasks = malloc((numTasks / numThreads + 1) * sizeof(int));
+		deques[i].top = deques[i].bottom = 0;
+	}
+	// the bottom is popped first, so each deque is filled from the last task back
+	for (int task = numTasks - 1; task >= 0; task--) {
+		Deque *deque = &deques[task % numThreads];
+		deque->tasks[deque->bottom++] = task;
+	}
+
+	for (int i = 0; i < numThreads; i++) {
+		workers[i].tasks = tasks;
+		workers[i].deques = deques;
+		workers[i].numDeques = numThreads;
+		workers[i].self = i;
+	}
+	// this thread is worker 0
+	for (int i = 1; i < numThreads; i++)
+		pthread_create(&threads[i], NULL, work, &workers[i]);
+	work(&workers[0]);
+	for (int i = 1; i < numThreads; i++)
+		pthread_join(threads[i], NULL);
+
+	for (int i = 0; i < numThreads; i++) {
+		pthread_mutex_destroy(&deques[i].lock);
+		free(deques[i].tasks);
+	}
+}
+
+
+static void *work(void *arg)
+{
+	Worker *worker = arg;
+
+	while (1) {
+		int task = popBottom(&worker->deques[worker->self]);
+
+		// no new tasks are ever added, so once every deque is
+		// empty, there's nothing left to do
+		for (int i = 1; task == -1 && i < worker->numDeques; i++)
+			task = stealTop(&worker->deques[(worker->self + i) % worker->numDeques]);
+		if (task == -1)
+			return NULL;
+
+		worker->tasks[task].run(worker->tasks[task].arg);
+	}
+}
+
+
+static int popBottom(Deque *deque)
+{
+	int task = -1;
+
+	pthread_mutex_lock(&deque->lock);
+	if (deque->bottom > deque->top)
+		task = deque->tasks[--deque->bottom];
+	pthread_mutex_unlock(&deque->lock);
+	return task;
+}
+
+
+static int stealTop(Deque *deque)
+{
+	int task = -1;
+
+	pthread_mutex_lock(&deque->lock);
+	if (deque->bottom > deque->top)
+		task = deque->tasks[deque->top++];
+	pthread_mutex_unlock(&deque->lock);
+	return task;
+}
+
+
+void initQueue(Queue *queue, int capacity)
+{
+	pthread_mutex_init(&queue->lock, NULL);
+	pthread_cond_init(&queue->notEmpty, NULL);
+	pthread_cond_init(&queue->notFull, NULL);
+	queue->items = malloc(capacity * sizeof(void *));
+	queue->capacity = capacity;
+	queue->head = queue->length = 0;
+}
+
+
+void destroyQueue(Queue *queue)
+{
+	pthread_mutex_destroy(&queue->lock);
+	pthread_cond_destroy(&queue->notEmpty);
+	pthread_cond_destroy(&queue->notFull);
+	free(queue->items);
+}
+
+
+void pushQueue(Queue *queue, void *item)
+{
+	pthread_mutex_lock(&queue->lock);
+	while (queue->length == queue->capacity)
+		pthread_cond_wait(&queue->notFull, &queue->lock);
+	queue->items[(queue->head + queue->length++) % queue->capacity] = item;
+	pthread_cond_signal(&queue->notEmpty);
+	pthread_mutex_unlock(&queue->lock);
+}
+
+
+void *popQueue(Queue *queue)
+{
+	void *item;
+
+	pthread_mutex_lock(&queue->lock);
+	while (queue->length == 0)
+		pthread_cond_wait(&queue->notEmpty, &queue->lock);
+	item = queue->items[queue->head];
+	queue->head = (queue->head + 1) % queue->capacity;
+	queue->length--;
+	pthread_cond_signal(&queue->notFull);
+	pthread_mutex_unlock(&queue->lock);
+	return item;
+}
@@ -0,0 +1,26 @@
+#include <pthread.h>
+
+#ifndef POOL_H
+#define POOL_H
+
+typedef struct {
+	void (*run)(void *arg);
+	void *arg;
+} Task;
+
+// a bounded queue for handing items from one thread to another. Pushing
+// waits while it's full, and popping waits while it's empty
+typedef struct {
+	pthread_mutex_t lock;
+	pthread_cond_t notEmpty, notFull;
+	void **items;
+	int capacity, head, length;
+} Queue;
+
+void runTasks(Task *tasks, int numTasks, int numThreads);
+void initQueue(Queue *queue, int capacity);
+void destroyQueue(Queue *queue);
+void pushQueue(Queue *queue, void *item);
+void *popQueue(Queue *queue);
+
+#endif
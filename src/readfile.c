@@ -5,51 +5,44 @@
 
 #include "files.h"
 #include "util.h"
+#include "trace.h"
 
-FILE *fp;
+_Thread_local FILE *fp;
+_Thread_local char *playerFile = "Players.txt";
 
 
 void readInPlayers()
 {
-	fp = fopen("Players.txt", "r");
+	TRACE_SCOPE("readInPlayers");
+	fp = fopen(playerFile, "r");
 	int playerIdx = 0;
-	int isEOF = 0;
-	int i;
-	char temp;
-	char tempStr[MAXLINE];
+	int c;
 	players = malloc(0);
 
+	if (fp == NULL) {
+		fprintf(stderr, "ERROR: Couldn't open \"%s\"\n", playerFile);
+		if (errorHandler != NULL)
+			longjmp(*errorHandler, 1);
+		exit(1);
+	}
+
 
-	while (!isEOF) {
+	while (1) {
 		// this skips over comments
 		while (getToken(fp) == HASHTAG)
-			while (fgetc(fp) != '\n')
+			while ((c = fgetc(fp)) != '\n' && c != EOF)
 				;
 		if (tokenType == EOF)
 			break;
 
 
 		players = realloc(players, sizeof(Player) * (playerIdx + 1));
-
-		getID(playerIdx);
-		getName(playerIdx);
-		getPrevPairedPlayers(playerIdx);
-		getScore(playerIdx);
-		getTimes(playerIdx);
-
-		// saves the rest of the line as a comment
-		for (i = 0; (temp = fgetc(fp)) != '\n'; i++)
-			tempStr[i] = temp;
-		tempStr[i++] = '\0';
-		players[playerIdx].comment = malloc(i * sizeof (char));
-		strcpy(players[playerIdx].comment, tempStr);
-
+		// if the roster turns out to be broken, everyone read so far
+		// (and whatever this player got to) can still be freed
+		memset(&players[playerIdx], 0, sizeof(Player));
+		totalPlayers = playerIdx + 1;
+		readPlayer(playerIdx);
 		playerIdx++;
-
-		if (temp == EOF)
-			isEOF = 1;
-		else
-			fseek(fp, -1, SEEK_CUR);
 	}
 	fclose(fp);
 
@@ -59,6 +52,23 @@ void readInPlayers()
 }
 
 
+// reads in the rest of a player, after their first token has been read
+void readPlayer(int playerIdx)
+{
+	getID(playerIdx);
+	getName(playerIdx);
+	getPrevPairedPlayers(playerIdx);
+	getScore(playerIdx);
+	getTimes(playerIdx);
+	getComment(playerIdx);
+
+	players[playerIdx].paired = 0;
+	players[playerIdx].line = 0;
+	players[playerIdx].lineStart = 0;
+	players[playerIdx].lineHash = 0;
+}
+
+
 void getID(int playerIdx)
 {
 	if (tokenType != NUMBER) {
@@ -91,9 +101,9 @@ void getPrevPairedPlayers(int playerIdx)
 		while (tokenType != EOF) {
 			if (tokenType == NUMBER) {
 				if (size == 0)
-					players[playerIdx].prevPlayed = malloc(++size);				
+					players[playerIdx].prevPlayed = malloc(++size * sizeof(int));
 				else
-					players[playerIdx].prevPlayed = realloc(players[playerIdx].prevPlayed, ++size);
+					players[playerIdx].prevPlayed = realloc(players[playerIdx].prevPlayed, ++size * sizeof(int));
 				players[playerIdx].prevPlayed[size - 1] = numToken;
 			} else {
 				printError(EXPECTED_NUMBER);
@@ -108,6 +118,7 @@ void getPrevPairedPlayers(int playerIdx)
 		players[playerIdx].prevPlayed = NULL;
 	}
 	players[playerIdx].prevPlayedNum = size;
+	players[playerIdx].prevPlayedCap = size;
 }
 
 
@@ -115,7 +126,7 @@ void getScore(int playerIdx)
 {
 	if (getToken(fp) != NUMBER)
 		printError(EXPECTED_NUMBER);
-	players[playerIdx].score = (float)numToken;
+	players[playerIdx].score = numToken * 2;
 	if (getToken(fp) != DOT)
 		printError(EXPECTED_DOT);
 	if (getToken(fp) != NUMBER)
@@ -124,17 +135,15 @@ void getScore(int playerIdx)
 		printError(EXPECTED_SINGLE_DIGIT);
 	if (numToken != 5 && numToken != 0)
 		printError(EXPECTED_HALF);
-	players[playerIdx].score += (float)numToken / 10.0;
+	players[playerIdx].score += numToken == 5;
 }
 
 
 void getTimes(int playerIdx)
 {
 	int day = 0;
-
-	for (int i = 0; i < DAYS_IN_WEEK; i++)
-		for (int j = 0; j < HOURS_IN_DAY; j++)
-			players[playerIdx].times[i][j] = 0;
+	// read into a bitmap first, since the ranges can come in any order
+	uint64_t times[DAYS_IN_WEEK][WORDS_IN_DAY] = { { 0 } };
 
 	/* Loop through each day of the week:
 	 *   Loop through each range of each day:
@@ -145,14 +154,17 @@ void getTimes(int playerIdx)
 		printError(EXPECTED_CURLY_BRACKET);
 
 	while (day < DAYS_IN_WEEK)
-		getDayTimes(players[playerIdx].times, day++);
+		getDayTimes(times, day++);
 
 	if (getToken(fp) != C_END_BRACKET)
 		printError(EXPECTED_CURLY_BRACKET);
+
+	setSummaries(&players[playerIdx], times);
+	setTimes(&players[playerIdx], times);
 }
 
 
-void getDayTimes(uint64_t times[DAYS_IN_WEEK][HOURS_IN_DAY], int day)
+void getDayTimes(uint64_t times[DAYS_IN_WEEK][WORDS_IN_DAY], int day)
 {
 	if (getToken(fp) != C_START_BRACKET)
 		printError(EXPECTED_CURLY_BRACKET);
@@ -161,13 +173,15 @@ void getDayTimes(uint64_t times[DAYS_IN_WEEK][HOURS_IN_DAY], int day)
 	if (getToken(fp) == C_END_BRACKET)
 		return;
 
-	do
+	getDayTime(times, day);
+	while (getToken(fp) == COMMA) {
+		getToken(fp);
 		getDayTime(times, day);
-	while (getToken(fp) == COMMA);
+	}
 }
 
 
-void getDayTime(uint64_t times[DAYS_IN_WEEK][HOURS_IN_DAY], int day)
+void getDayTime(uint64_t times[DAYS_IN_WEEK][WORDS_IN_DAY], int day)
 {
 	int startHour, endHour;
 	int startMinute, endMinute;
@@ -199,3 +213,31 @@ void getDayTime(uint64_t times[DAYS_IN_WEEK][HOURS_IN_DAY], int day)
 
 	setMinuteBits(times, day, startHour, endHour, startMinute, endMinute);
 }
+
+
+// saves the rest of the line as a comment
+void getComment(int playerIdx)
+{
+	int c;
+	int length = 0, size = 0;
+	char *comment = NULL;
+
+	players[playerIdx].commentOffset = ftell(fp);
+
+	while ((c = fgetc(fp)) != '\n' && c != EOF) {
+		length++;
+		// in low memory mode, only where the comment is gets saved
+		if (isLowMemory)
+			continue;
+		if (length >= size)
+			comment = realloc(comment, size = MAX(2 * size, 16));
+		comment[length - 1] = c;
+	}
+
+	players[playerIdx].commentLength = length;
+	if (!isLowMemory) {
+		comment = realloc(comment, length + 1);
+		comment[length] = '\0';
+	}
+	players[playerIdx].comment = comment;
+}
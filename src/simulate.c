@@ -0,0 +1,407 @@
+/* Simulation mode: instead of pairing this round, the next few rounds are
+ * played out many times over with random results, to see how well a choice of
+ * -p, -t and -e holds up later in the tournament. Every combination of the
+ * values given is tried, and each simulated round is paired the same way a
+ * real one would be with -m: matchPlayer (or pairExact, for small rosters),
+ * pairDutch or pairConstrained.
+ *
+ * The runs are split between the threads, and each thread has its own copy of
+ * the roster, with room for every opponent it'll ever get. After that's set
+ * up, a greedy round doesn't allocate anything, which is what lets it get
+ * through millions of them. Each run has its own seed, so the results are the same
+ * however many threads there are.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "simulate.h"
+#include "files.h"
+#include "pairing.h"
+#include "pool.h"
+#include "exact.h"
+#include "dutch.h"
+#include "constrained.h"
+#include "output.h"
+#include "util.h"
+
+// out of 20: the first player wins 9 times, draws twice and loses 9 times
+#define WIN_CHANCE            9
+#define DRAW_CHANCE           2
+
+// how many rounds to simulate. 0 means the players are paired as normal
+int simRounds;
+// how many times to simulate them
+int simRuns = 1000;
+// the values of -p, -t and -e to try, in the same units as the globals
+int pointDifGrid[MAX_GRID], timeDifGrid[MAX_GRID], earliestGrid[MAX_GRID];
+int numPointDifs, numTimeDifs, numEarliests;
+
+typedef struct {
+	// the real roster, for the thread running this to point itself at
+	Player *players;
+	int totalPlayers;
+	// the runs to simulate, from first (inclusive) to last (exclusive)
+	int first, last;
+	// this thread's copy of the roster, and somewhere to sort it into
+	Player *roster, *sorted;
+	// for counting the players with each score when sorting
+	int *counts, numCounts;
+	Pairing *pairings;
+	// totals over every round of every run
+	long long unpaired, blocked, length;
+	int worstUnpaired, roundsPlayed;
+} SimTask;
+
+static void simulateRuns(void *arg);
+static void simulateRound(SimTask *task, uint64_t *seed);
+static void resetRoster(SimTask *task);
+static void sortRoster(SimTask *task);
+static int isBlockedByHistory(Player *p1, Player *p2);
+static void printResults(SimTask *tasks, int numTasks);
+static void emitFloat(double num, int width);
+static uint64_t nextRandom(uint64_t *seed);
+
+
+void simulate()
+{
+	int numTasks = MAX(MIN(numThreads, simRuns), 1);
+	SimTask *simTasks = malloc(numTasks * sizeof(SimTask));
+	Task *tasks = malloc(numTasks * sizeof(Task));
+	int minScore = 0, maxScore = 0;
+	int p = maxPointDif, t = minTimeDif, e = earliestTime, threads = numThreads;
+
+	// anything that isn't being varied stays at whatever it's set to
+	if (numPointDifs == 0)
+		pointDifGrid[numPointDifs++] = maxPointDif;
+	if (numTimeDifs == 0)
+		timeDifGrid[numTimeDifs++] = minTimeDif;
+	if (numEarliests == 0)
+		earliestGrid[numEarliests++] = earliestTime;
+
+	for (int i = 0; i < totalPlayers; i++) {
+		minScore = i == 0 ? players[i].score : MIN(minScore, players[i].score);
+		maxScore = i == 0 ? players[i].score : MAX(maxScore, players[i].score);
+	}
+
+	for (int i = 0; i < numTasks; i++) {
+		SimTask *task = &simTasks[i];
+
+		task->players = players;
+		task->totalPlayers = totalPlayers;
+		task->first = (long long)simRuns * i / numTasks;
+		task->last = (long long)simRuns * (i + 1) / numTasks;
+		task->roster = malloc((totalPlayers + 1) * sizeof(Player));
+		task->sorted = malloc((totalPlayers + 1) * sizeof(Player));
+		// a round moves a score by at most a point
+		task->numCounts = maxScore - minScore + 2 * simRounds + 1;
+		task->counts = malloc(task->numCounts * sizeof(int));
+		task->pairings = malloc((totalPlayers / 2 + 1) * sizeof(Pairing));
+
+		for (int j = 0; j < totalPlayers; j++) {
+			task->roster[j] = players[j];
+			task->roster[j].prevPlayedCap = players[j].prevPlayedNum + simRounds;
+			task->roster[j].prevPlayed = malloc(task->roster[j].prevPlayedCap * sizeof(int));
+			// where they are in the (sorted) roster, to put them back there
+			task->roster[j].line = j;
+		}
+
+		tasks[i].run = simulateRuns;
+		tasks[i].arg = task;
+	}
+
+	beginOutput();
+	if (outputFormat == FORMAT_TEXT) {
+		emitString("Simulated ");
+		emitInt(simRounds);
+		emitString(" rounds ");
+		emitInt(simRuns);
+		emitString(" times\n");
+		emitString("     -p    -t     -e  unpaired  worst  blocked  length\n");
+	} else if (outputFormat == FORMAT_CSV) {
+		emitString("maxPointDif,minTimeDif,earliestTime,unpaired,worst,blocked,length\n");
+	} else {
+		emitString("\"rounds\":");
+		emitInt(simRounds);
+		emitString(",\"runs\":");
+		emitInt(simRuns);
+		emitString(",\"results\":[");
+	}
+
+	// the globals are only read while the threads are running, so
+	// each combination is simulated by all of them at once. The threads are
+	// shared out between the runs, not within each round
+	numThreads = 1;
+	for (int i = 0; i < numPointDifs; i++)
+		for (int j = 0; j < numTimeDifs; j++)
+			for (int k = 0; k < numEarliests; k++) {
+				maxPointDif = pointDifGrid[i];
+				minTimeDif = timeDifGrid[j];
+				earliestTime = earliestGrid[k];
+				runTasks(tasks, numTasks, threads);
+				if (outputFormat == FORMAT_JSON && i + j + k != 0)
+					emitChar(',');
+				printResults(simTasks, numTasks);
+			}
+
+	if (outputFormat == FORMAT_JSON)
+		emitChar(']');
+	endOutput();
+
+	numThreads = threads;
+	maxPointDif = p;
+	minTimeDif = t;
+	earliestTime = e;
+	for (int i = 0; i < numTasks; i++) {
+		for (int j = 0; j < totalPlayers; j++)
+			free(simTasks[i].roster[j].prevPlayed);
+		free(simTasks[i].roster);
+		free(simTasks[i].sorted);
+		free(simTasks[i].counts);
+		free(simTasks[i].pairings);
+	}
+	free(simTasks);
+	free(tasks);
+}
+
+
+static void simulateRuns(void *arg)
+{
+	SimTask *task = arg;
+
+	players = task->players;
+	totalPlayers = task->totalPlayers;
+	task->unpaired = task->blocked = task->length = 0;
+	task->worstUnpaired = task->roundsPlayed = 0;
+
+	for (int run = task->first; run < task->last; run++) {
+		uint64_t seed = 0x9e3779b97f4a7c15ull * (run + 1);
+
+		resetRoster(task);
+		for (int round = 0; round < simRounds; round++)
+			simulateRound(task, &seed);
+	}
+}
+
+
+static void simulateRound(SimTask *task, uint64_t *seed)
+{
+	Player *roster = task->roster;
+	int size = 0, unpaired, blocked = 0, isExact = 0;
+
+	for (int i = 0; i < totalPlayers; i++)
+		roster[i].paired = 0;
+	// the same choice as pairPlayers makes
+	if (pairingMode != MODE_DUTCH && totalPlayers <= EXACT_PLAYERS)
+		isExact = pairExact(roster, totalPlayers, task->pairings, &size);
+	if (!isExact && pairingMode != MODE_GREEDY) {
+		Pairing *pairings;
+
+		// these pair whatever the thread's roster is, so it's pointed at this copy for now
+		players = roster;
+		pairings = pairingMode == MODE_DUTCH ? pairDutch(&size) : pairConstrained(&size);
+		players = task->players;
+		memcpy(task->pairings, pairings, size * sizeof(Pairing));
+		free(pairings);
+	} else if (!isExact) {
+		for (int i = 0; i < totalPlayers - 1; i++)
+			matchPlayer(roster, task->pairings, &size, i, totalPlayers);
+	}
+
+	unpaired = totalPlayers - 2 * size;
+	task->unpaired += unpaired;
+	task->worstUnpaired = MAX(task->worstUnpaired, unpaired);
+	task->roundsPlayed++;
+
+	// how many of the unpaired players could've been paired with someone if
+	// they hadn't already played them. The roster's sorted by score, so only
+	// the players near them need checking
+	for (int i = 0; i < totalPlayers; i++) {
+		if (roster[i].paired)
+			continue;
+		for (int j = i - 1; j >= 0 && roster[j].score - roster[i].score <= maxPointDif; j--)
+			if (isBlockedByHistory(&roster[i], &roster[j])) {
+				blocked++;
+				goto nextPlayer;
+			}
+		for (int j = i + 1; j < totalPlayers && roster[i].score - roster[j].score <= maxPointDif; j++)
+			if (isBlockedByHistory(&roster[i], &roster[j])) {
+				blocked++;
+				break;
+			}
+nextPlayer:
+		;
+	}
+	task->blocked += blocked;
+
+	// from the first match starting to the last one finishing
+	if (size > 0) {
+		int first = task->pairings[0].time, last = task->pairings[0].time;
+		for (int i = 1; i < size; i++) {
+			first = MIN(first, task->pairings[i].time);
+			last = MAX(last, task->pairings[i].time);
+		}
+		task->length += last + minTimeDif - first;
+	}
+
+	for (int i = 0; i < size; i++) {
+		int result = nextRandom(seed) % 20;
+		if (result < WIN_CHANCE) {
+			task->pairings[i].p1->score += 2;
+		} else if (result < WIN_CHANCE + DRAW_CHANCE) {
+			task->pairings[i].p1->score++;
+			task->pairings[i].p2->score++;
+		} else {
+			task->pairings[i].p2->score += 2;
+		}
+	}
+
+	sortRoster(task);
+}
+
+
+// puts everyone back to how they are in the real roster
+static void resetRoster(SimTask *task)
+{
+	for (int i = 0; i < totalPlayers; i++) {
+		Player *player = &task->roster[i], *original = &players[player->line];
+
+		player->score = original->score;
+		player->prevPlayedNum = original->prevPlayedNum;
+		if (original->prevPlayedNum > 0)
+			memcpy(player->prevPlayed, original->prevPlayed, original->prevPlayedNum * sizeof(int));
+	}
+	sortRoster(task);
+}
+
+
+/* Sorts the roster by score, the same way sortPlayers does: highest first, and
+ * in the order of the real roster for the same score. The players are put back
+ * in that order first, then a counting sort on their scores keeps it for the
+ * players with the same score.
+ */
+static void sortRoster(SimTask *task)
+{
+	int maxScore = task->roster[0].score;
+
+	for (int i = 0; i < totalPlayers; i++) {
+		task->sorted[task->roster[i].line] = task->roster[i];
+		maxScore = MAX(maxScore, task->roster[i].score);
+	}
+
+	memset(task->counts, 0, task->numCounts * sizeof(int));
+	for (int i = 0; i < totalPlayers; i++)
+		task->counts[maxScore - task->sorted[i].score]++;
+	// each count becomes where the first player with that score goes
+	for (int i = 0, total = 0; i < task->numCounts; i++) {
+		int count = task->counts[i];
+		task->counts[i] = total;
+		total += count;
+	}
+	for (int i = 0; i < totalPlayers; i++)
+		task->roster[task->counts[maxScore - task->sorted[i].score]++] = task->sorted[i];
+}
+
+
+// returns 1 if the players could've been paired, but have already played each other
+static int isBlockedByHistory(Player *p1, Player *p2)
+{
+	int startTime = 0, endTime = 0;
+
+	if (!haveFought(*p1, *p2) || !canOverlap(p1, p2))
+		return 0;
+	while (getNextRange(p1, p2, dayOfWeek, &startTime, &endTime))
+		if (MAX(startTime, earliestTime) <= endTime - minTimeDif)
+			return 1;
+	return 0;
+}
+
+
+// prints the averages over every run for the current -p, -t and -e
+static void printResults(SimTask *tasks, int numTasks)
+{
+	long long unpaired = 0, blocked = 0, length = 0;
+	int worst = 0, rounds = 0;
+
+	for (int i = 0; i < numTasks; i++) {
+		unpaired += tasks[i].unpaired;
+		blocked += tasks[i].blocked;
+		length += tasks[i].length;
+		worst = MAX(worst, tasks[i].worstUnpaired);
+		rounds += tasks[i].roundsPlayed;
+	}
+	rounds = MAX(rounds, 1);
+
+	switch (outputFormat) {
+		case FORMAT_TEXT:
+			emitString("  ");
+			emitPadded("", 3 - numLength(maxPointDif / 2));
+			emitScore(maxPointDif);
+			emitPadded("", 6 - numLength(minTimeDif));
+			emitInt(minTimeDif);
+			emitString("  ");
+			emitTime(earliestTime);
+			emitFloat((double)unpaired / rounds, 10);
+			emitPadded("", 7 - numLength(worst));
+			emitInt(worst);
+			emitFloat((double)blocked / rounds, 9);
+			emitString("   ");
+			emitTime(length / rounds);
+			emitChar('\n');
+			break;
+
+		case FORMAT_CSV:
+			emitScore(maxPointDif);
+			emitChar(',');
+			emitInt(minTimeDif);
+			emitChar(',');
+			emitTime(earliestTime);
+			emitChar(',');
+			emitFloat((double)unpaired / rounds, 0);
+			emitChar(',');
+			emitInt(worst);
+			emitChar(',');
+			emitFloat((double)blocked / rounds, 0);
+			emitChar(',');
+			emitInt(length / rounds);
+			emitChar('\n');
+			break;
+
+		case FORMAT_JSON:
+			emitString("{\"maxPointDif\":");
+			emitScore(maxPointDif);
+			emitString(",\"minTimeDif\":");
+			emitInt(minTimeDif);
+			emitString(",\"earliestTime\":\"");
+			emitTime(earliestTime);
+			emitString("\",\"unpaired\":");
+			emitFloat((double)unpaired / rounds, 0);
+			emitString(",\"worstUnpaired\":");
+			emitInt(worst);
+			emitString(",\"blocked\":");
+			emitFloat((double)blocked / rounds, 0);
+			emitString(",\"length\":");
+			emitInt(length / rounds);
+			emitChar('}');
+			break;
+	}
+}
+
+
+// with 2 decimals, padded on the left to width
+static void emitFloat(double num, int width)
+{
+	char str[32];
+
+	snprintf(str, sizeof(str), "%.2f", num);
+	emitPadded(str, width);
+}
+
+
+static uint64_t nextRandom(uint64_t *seed)
+{
+	*seed ^= *seed << 13;
+	*seed ^= *seed >> 7;
+	*seed ^= *seed << 17;
+	return *seed;
+}
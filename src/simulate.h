@@ -0,0 +1,15 @@
+#include "misc.h"
+
+#ifndef SIMULATE_H
+#define SIMULATE_H
+
+// the most values -p, -t or -e can be given to simulate
+#define MAX_GRID              16
+
+void simulate(void);
+
+extern int simRounds, simRuns;
+extern int pointDifGrid[], timeDifGrid[], earliestGrid[];
+extern int numPointDifs, numTimeDifs, numEarliests;
+
+#endif
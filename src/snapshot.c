@@ -0,0 +1,302 @@
+/* Snapshots of the roster, for watch mode. Every version of the roster that's
+ * paired is kept, so the director can go back to any of them, or see how one
+ * pairs with different options, without touching the roster file.
+ *
+ * A snapshot is a table of chunks, and a chunk is a table of pointers to saved
+ * players. Nothing that's been saved is ever changed, so a snapshot shares
+ * every chunk that's the same as in the snapshot it was taken from, and a new
+ * chunk shares every player that's been saved before. A player is only saved
+ * again if their line of the roster has changed, so each snapshot only costs
+ * the players that changed. Going back to a snapshot works the same way round:
+ * only the players that are different from the roster as it is get copied.
+ *
+ * Only the last MAX_SNAPSHOTS are kept. Chunks and saved players count how
+ * many times they're shared, so dropping a snapshot frees whatever only it
+ * was using.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "files.h"
+#include "util.h"
+#include "pairing.h"
+#include "snapshot.h"
+
+// a saved player, and how many chunks it's in
+typedef struct {
+	// first, so a pointer to the player is a pointer to this
+	Player player;
+	int refs;
+} SavedPlayer;
+
+static Snapshot *snapshots;
+int numSnapshots, currentSnapshot = -1;
+static int snapshotCap, numKept;
+// every saved player, in a hash table keyed by the hash of their line
+static SavedPlayer **saved;
+static int savedBits, numSaved;
+
+static void dropSnapshot(int id);
+static void releaseChunk(RosterChunk *chunk);
+static int isSameChunk(RosterChunk *chunk, Player *roster, int length);
+static Player *savePlayer(Player *player, int *isNew);
+static void insertSaved(SavedPlayer *player);
+static void removeSaved(SavedPlayer *player);
+static void copyPlayer(Player *to, Player *from);
+
+
+// saves the roster as it is now, as a child of the current snapshot. The new
+// snapshot becomes the current one
+void takeSnapshot(const char *label)
+{
+	Snapshot *base = currentSnapshot == -1 ? NULL : &snapshots[currentSnapshot];
+	Snapshot snapshot;
+
+	snapshot.parent = currentSnapshot;
+	snprintf(snapshot.label, SNAPSHOT_LABEL, "%s", label);
+	snapshot.numPlayers = totalPlayers;
+	snapshot.numChunks = (totalPlayers + SNAPSHOT_CHUNK - 1) / SNAPSHOT_CHUNK;
+	snapshot.numChanged = 0;
+	snapshot.chunks = malloc((snapshot.numChunks + 1) * sizeof(RosterChunk *));
+	snapshot.maxPointDif = maxPointDif;
+	snapshot.minTimeDif = minTimeDif;
+	snapshot.earliestTime = earliestTime;
+	snapshot.dayOfWeek = dayOfWeek;
+	snapshot.pairingMode = pairingMode;
+
+	for (int c = 0; c < snapshot.numChunks; c++) {
+		int first = c * SNAPSHOT_CHUNK, length = MIN(SNAPSHOT_CHUNK, totalPlayers - first);
+		RosterChunk *chunk;
+
+		if (base != NULL && c < base->numChunks && isSameChunk(base->chunks[c], players + first, length)) {
+			snapshot.chunks[c] = base->chunks[c];
+			snapshot.chunks[c]->refs++;
+			continue;
+		}
+		chunk = malloc(sizeof(RosterChunk));
+		chunk->numPlayers = length;
+		chunk->refs = 1;
+		for (int i = 0; i < length; i++) {
+			int isNew;
+			chunk->players[i] = savePlayer(&players[first + i], &isNew);
+			snapshot.numChanged += isNew;
+		}
+		snapshot.chunks[c] = chunk;
+	}
+
+	if (numSnapshots == snapshotCap) {
+		snapshotCap = MAX(2 * snapshotCap, 16);
+		snapshots = realloc(snapshots, snapshotCap * sizeof(Snapshot));
+	}
+	snapshots[numSnapshots] = snapshot;
+	currentSnapshot = numSnapshots++;
+
+	// the one it was taken from is still in use when trying other options,
+	// so neither of them is dropped
+	if (++numKept > MAX_SNAPSHOTS)
+		for (int i = 0; i < numSnapshots; i++)
+			if (snapshots[i].chunks != NULL && i != currentSnapshot && i != snapshot.parent) {
+				dropSnapshot(i);
+				break;
+			}
+}
+
+
+// makes the roster the same as the snapshot, along with the options it was
+// paired with, and makes it the current snapshot.
+// Returns 1 if successful; 0 if there's no such snapshot
+int restoreSnapshot(int id)
+{
+	Snapshot *from, *to;
+
+	if (id < 0 || id >= numSnapshots || snapshots[id].chunks == NULL)
+		return 0;
+	from = &snapshots[currentSnapshot];
+	to = &snapshots[id];
+
+	for (int i = to->numPlayers; i < totalPlayers; i++)
+		freePlayer(&players[i]);
+	if (to->numPlayers > totalPlayers)
+		players = realloc(players, (to->numPlayers + 1) * sizeof(Player));
+
+	// the roster is always the same as the current snapshot, so anything
+	// that's shared with it is already in place
+	for (int c = 0; c < to->numChunks; c++) {
+		RosterChunk *chunk = to->chunks[c], *old = c < from->numChunks ? from->chunks[c] : NULL;
+
+		if (chunk == old)
+			continue;
+		for (int i = 0; i < chunk->numPlayers; i++) {
+			int player = c * SNAPSHOT_CHUNK + i;
+
+			if (old != NULL && i < old->numPlayers && old->players[i] == chunk->players[i])
+				continue;
+			if (player < totalPlayers)
+				freePlayer(&players[player]);
+			copyPlayer(&players[player], chunk->players[i]);
+		}
+	}
+
+	totalPlayers = to->numPlayers;
+	maxPointDif = to->maxPointDif;
+	minTimeDif = to->minTimeDif;
+	earliestTime = to->earliestTime;
+	dayOfWeek = to->dayOfWeek;
+	pairingMode = to->pairingMode;
+	currentSnapshot = id;
+	return 1;
+}
+
+
+void listSnapshots()
+{
+	fprintf(stderr, "     id  parent  players  saved  label\n");
+	for (int i = 0; i < numSnapshots; i++) {
+		if (snapshots[i].chunks == NULL)
+			continue;
+		fprintf(stderr, "%c %5d  ", i == currentSnapshot ? '*' : ' ', i);
+		if (snapshots[i].parent == -1)
+			fprintf(stderr, "%6s", "-");
+		else
+			fprintf(stderr, "%6d", snapshots[i].parent);
+		fprintf(stderr, "  %7d  %5d  %s\n", snapshots[i].numPlayers, snapshots[i].numChanged, snapshots[i].label);
+	}
+}
+
+
+static void dropSnapshot(int id)
+{
+	for (int c = 0; c < snapshots[id].numChunks; c++)
+		releaseChunk(snapshots[id].chunks[c]);
+	free(snapshots[id].chunks);
+	snapshots[id].chunks = NULL;
+	numKept--;
+}
+
+
+// frees the chunk once no snapshot has it, along with any players that were
+// only in it
+static void releaseChunk(RosterChunk *chunk)
+{
+	if (--chunk->refs > 0)
+		return;
+	for (int i = 0; i < chunk->numPlayers; i++) {
+		SavedPlayer *player = (SavedPlayer *)chunk->players[i];
+
+		if (--player->refs > 0)
+			continue;
+		removeSaved(player);
+		freePlayer(&player->player);
+		free(player);
+	}
+	free(chunk);
+}
+
+
+static int isSameChunk(RosterChunk *chunk, Player *roster, int length)
+{
+	if (chunk->numPlayers != length)
+		return 0;
+	for (int i = 0; i < length; i++)
+		if (chunk->players[i]->lineHash != roster[i].lineHash)
+			return 0;
+	return 1;
+}
+
+
+// returns the saved copy of the player, saving one first if they haven't
+// been, for one more chunk. isNew is set to 1 if they had to be saved; 0
+// otherwise. A player's saved by their line alone, so one that's only moved
+// is shared with where they were, line number and all
+static Player *savePlayer(Player *player, int *isNew)
+{
+	SavedPlayer *copy;
+
+	if (saved != NULL) {
+		uint64_t mask = ((uint64_t)1 << savedBits) - 1;
+		for (uint64_t slot = player->lineHash & mask; saved[slot] != NULL; slot = (slot + 1) & mask)
+			if (saved[slot]->player.lineHash == player->lineHash) {
+				*isNew = 0;
+				saved[slot]->refs++;
+				return &saved[slot]->player;
+			}
+	}
+
+	*isNew = 1;
+	copy = malloc(sizeof(SavedPlayer));
+	copyPlayer(&copy->player, player);
+	copy->refs = 1;
+
+	// it's kept at most half full, so the probes stay short
+	if (2 * (numSaved + 1) > 1 << savedBits) {
+		SavedPlayer **old = saved;
+		int oldSize = saved == NULL ? 0 : 1 << savedBits;
+
+		savedBits = MAX(savedBits + 1, 10);
+		saved = calloc((size_t)1 << savedBits, sizeof(SavedPlayer *));
+		numSaved = 0;
+		for (int i = 0; i < oldSize; i++)
+			if (old[i] != NULL)
+				insertSaved(old[i]);
+		free(old);
+	}
+	insertSaved(copy);
+	return &copy->player;
+}
+
+
+static void insertSaved(SavedPlayer *player)
+{
+	uint64_t mask = ((uint64_t)1 << savedBits) - 1, slot = player->player.lineHash & mask;
+
+	while (saved[slot] != NULL)
+		slot = (slot + 1) & mask;
+	saved[slot] = player;
+	numSaved++;
+}
+
+
+// takes the player out of the table, moving back anyone after them who'd
+// otherwise no longer be found
+static void removeSaved(SavedPlayer *player)
+{
+	uint64_t mask = ((uint64_t)1 << savedBits) - 1, slot = player->player.lineHash & mask;
+
+	while (saved[slot] != player)
+		slot = (slot + 1) & mask;
+	for (uint64_t next = (slot + 1) & mask; saved[next] != NULL; next = (next + 1) & mask) {
+		uint64_t home = saved[next]->player.lineHash & mask;
+		// it can fill the gap if the gap's between its home and where it is
+		if (((next - home) & mask) >= ((next - slot) & mask)) {
+			saved[slot] = saved[next];
+			slot = next;
+		}
+	}
+	saved[slot] = NULL;
+	numSaved--;
+}
+
+
+// copies everything the player has, so neither copy depends on the other
+static void copyPlayer(Player *to, Player *from)
+{
+	*to = *from;
+	to->paired = 0;
+	to->name = strdup(from->name);
+	to->prevPlayedCap = from->prevPlayedNum + 1;
+	to->prevPlayed = malloc(to->prevPlayedCap * sizeof(int));
+	if (from->prevPlayedNum > 0)
+		memcpy(to->prevPlayed, from->prevPlayed, from->prevPlayedNum * sizeof(int));
+	if (from->comment != NULL)
+		to->comment = strdup(from->comment);
+	if (from->times != NULL) {
+		to->times = malloc(DAYS_IN_WEEK * sizeof(*from->times));
+		memcpy(to->times, from->times, DAYS_IN_WEEK * sizeof(*from->times));
+	}
+	if (from->ranges != NULL) {
+		to->ranges = malloc((from->rangeStart[DAYS_IN_WEEK] + 1) * sizeof(TimeRange));
+		memcpy(to->ranges, from->ranges, from->rangeStart[DAYS_IN_WEEK] * sizeof(TimeRange));
+	}
+}
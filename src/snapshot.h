@@ -0,0 +1,41 @@
+#include "misc.h"
+
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+// how many players each chunk of a snapshot holds
+#define SNAPSHOT_CHUNK        64
+#define SNAPSHOT_LABEL        64
+// the most snapshots kept. Past that, the oldest one that isn't in use is
+// dropped
+#define MAX_SNAPSHOTS         64
+
+// a run of the roster, shared by every snapshot it's the same in. Each
+// player is a saved copy, shared by every chunk that has that version of them
+typedef struct {
+	int numPlayers;
+	Player *players[SNAPSHOT_CHUNK];
+	// how many snapshots share it
+	int refs;
+} RosterChunk;
+
+typedef struct {
+	// the snapshot this one was taken from, or -1
+	int parent;
+	char label[SNAPSHOT_LABEL];
+	int numPlayers, numChunks;
+	// how many players had to be saved for this snapshot
+	int numChanged;
+	// NULL once it's been dropped
+	RosterChunk **chunks;
+	// what the roster was paired with
+	int maxPointDif, minTimeDif, earliestTime, dayOfWeek, pairingMode;
+} Snapshot;
+
+void takeSnapshot(const char *label);
+int restoreSnapshot(int id);
+void listSnapshots(void);
+
+extern int numSnapshots, currentSnapshot;
+
+#endif
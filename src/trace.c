@@ -0,0 +1,190 @@
+/* The tracer behind trace.h. Each thread records its events into its own
+ * chain of blocks, so recording one never takes a lock: the only shared state
+ * is the list of threads, which a thread adds itself to once, with a compare
+ * and swap. At exit, every thread's events are written out as Chrome
+ * trace-event JSON, which chrome://tracing and Perfetto can both open.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "trace.h"
+
+#if TRACE
+
+#include <stdatomic.h>
+
+// how many events each block of a thread's chain holds
+#define TRACE_BLOCK           4096
+
+typedef struct {
+	const char *name;
+	// 'B' for the beginning of an event, 'E' for the end
+	char phase;
+	int64_t arg;
+	// in nanoseconds
+	uint64_t time;
+} TraceEvent;
+
+typedef struct TraceBlock {
+	TraceEvent events[TRACE_BLOCK];
+	struct TraceBlock *next;
+} TraceBlock;
+
+typedef struct TraceThread {
+	TraceBlock *first, *last;
+	// how many events have been recorded. It's only ever written by its own
+	// thread, after the event's in place, so the dump never sees half of one
+	_Atomic uint64_t count;
+	// how many events there wasn't room for
+	uint64_t dropped;
+	int id;
+	struct TraceThread *next;
+} TraceThread;
+
+static _Atomic(TraceThread *) threads;
+static atomic_int numThreads;
+// set once the trace is being written out, so nothing's added while it is
+static atomic_int isDumping;
+static _Thread_local TraceThread *thread;
+
+static void recordEvent(const char *name, char phase, int64_t arg);
+static char *matchEvents(TraceThread *thread, uint64_t count);
+
+
+const char *beginTrace(const char *name, int64_t arg)
+{
+	recordEvent(name, 'B', arg);
+	return name;
+}
+
+
+void endTrace(const char **name)
+{
+	recordEvent(*name, 'E', -1);
+}
+
+
+static void recordEvent(const char *name, char phase, int64_t arg)
+{
+	struct timespec now;
+	TraceEvent *event;
+	uint64_t count;
+
+	if (atomic_load_explicit(&isDumping, memory_order_relaxed))
+		return;
+	if (thread == NULL) {
+		thread = calloc(1, sizeof(TraceThread));
+		thread->first = thread->last = calloc(1, sizeof(TraceBlock));
+		thread->id = atomic_fetch_add(&numThreads, 1);
+		thread->next = atomic_load(&threads);
+		while (!atomic_compare_exchange_weak(&threads, &thread->next, thread))
+			;
+	}
+
+	count = atomic_load_explicit(&thread->count, memory_order_relaxed);
+	if (count == TRACE_EVENTS) {
+		thread->dropped++;
+		return;
+	}
+	if (count > 0 && count % TRACE_BLOCK == 0) {
+		thread->last->next = calloc(1, sizeof(TraceBlock));
+		thread->last = thread->last->next;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	event = &thread->last->events[count % TRACE_BLOCK];
+	event->name = name;
+	event->phase = phase;
+	event->arg = arg;
+	event->time = now.tv_sec * 1000000000ull + now.tv_nsec;
+	atomic_store_explicit(&thread->count, count + 1, memory_order_release);
+}
+
+
+// recording's stopped first, and only the events that were finished by then
+// are read, so this is safe even if exit() was called from a thread that's
+// still running
+void dumpTrace()
+{
+	FILE *file;
+	int isFirst = 1;
+
+	atomic_store(&isDumping, 1);
+	file = fopen(TRACE_FILE, "w");
+	if (file == NULL) {
+		fprintf(stderr, "ERROR: Couldn't write the trace to \"%s\"\n", TRACE_FILE);
+		return;
+	}
+
+	fprintf(file, "{\"traceEvents\":[");
+	for (TraceThread *current = atomic_load(&threads); current != NULL; current = current->next) {
+		uint64_t count = atomic_load_explicit(&current->count, memory_order_acquire);
+		char *isMatched = matchEvents(current, count);
+		TraceBlock *block = current->first;
+
+		for (uint64_t i = 0; i < count; i++) {
+			TraceEvent *event;
+
+			if (i > 0 && i % TRACE_BLOCK == 0)
+				block = block->next;
+			event = &block->events[i % TRACE_BLOCK];
+			if (!isMatched[i])
+				continue;
+			fprintf(file, "%s\n{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":1,\"tid\":%d",
+					isFirst ? "" : ",", event->name, event->phase, event->time / 1000.0, current->id);
+			if (event->arg != -1)
+				fprintf(file, ",\"args\":{\"arg\":%lld}", (long long)event->arg);
+			fprintf(file, "}");
+			isFirst = 0;
+		}
+		if (current->dropped > 0)
+			fprintf(stderr, "Warning: thread %d's last %llu trace events didn't fit in TRACE_EVENTS\n",
+					current->id, (unsigned long long)current->dropped);
+		free(isMatched);
+	}
+	fprintf(file, "\n]}\n");
+	fclose(file);
+}
+
+
+// works out which events have both their beginning and their end. An event
+// can be left without an end if the trace ran out of room, the program exited
+// in the middle of it, or a parse error jumped out of it
+static char *matchEvents(TraceThread *thread, uint64_t count)
+{
+	char *isMatched = calloc(count + 1, 1);
+	// the events that have begun but not ended yet, innermost last
+	uint64_t *open = malloc((count + 1) * sizeof(uint64_t));
+	const char **openNames = malloc((count + 1) * sizeof(char *));
+	uint64_t numOpen = 0;
+	TraceBlock *block = thread->first;
+
+	for (uint64_t i = 0; i < count; i++) {
+		TraceEvent *event;
+
+		if (i > 0 && i % TRACE_BLOCK == 0)
+			block = block->next;
+		event = &block->events[i % TRACE_BLOCK];
+		if (event->phase == 'B') {
+			openNames[numOpen] = event->name;
+			open[numOpen++] = i;
+			continue;
+		}
+		// anything that began since this one did never ended
+		for (uint64_t j = numOpen; j > 0; j--)
+			if (openNames[j - 1] == event->name) {
+				isMatched[open[j - 1]] = isMatched[i] = 1;
+				numOpen = j - 1;
+				break;
+			}
+	}
+
+	free(open);
+	free(openNames);
+	return isMatched;
+}
+
+#endif
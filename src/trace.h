@@ -0,0 +1,40 @@
+#include <stdint.h>
+
+#ifndef TRACE_H
+#define TRACE_H
+
+// the most events each thread keeps. Past that, the rest are dropped. Set it
+// at build time with "make TRACE=1 TRACE_EVENTS=..."
+#ifndef TRACE_EVENTS
+#define TRACE_EVENTS          (1 << 22)
+#endif
+#define TRACE_FILE            "trace.json"
+
+/* Trace points, which only exist in builds made with TRACE=1. TRACE_SCOPE
+ * marks the rest of the enclosing block as one event on the timeline,
+ * however it's left, and TRACE_SCOPE_ARG attaches a number to it as well.
+ * TRACE_START goes at the top of main, and writes everything out to
+ * TRACE_FILE when the program exits.
+ */
+#if TRACE
+
+#define TRACE_JOIN(a, b)      a##b
+#define TRACE_NAME(line)      TRACE_JOIN(traceScope, line)
+#define TRACE_SCOPE(name)     TRACE_SCOPE_ARG(name, -1)
+#define TRACE_SCOPE_ARG(name, arg) \
+	__attribute__((cleanup(endTrace))) const char *TRACE_NAME(__LINE__) = beginTrace(name, arg)
+#define TRACE_START()         atexit(dumpTrace)
+
+const char *beginTrace(const char *name, int64_t arg);
+void endTrace(const char **name);
+void dumpTrace(void);
+
+#else
+
+#define TRACE_SCOPE(name)
+#define TRACE_SCOPE_ARG(name, arg)
+#define TRACE_START()
+
+#endif
+
+#endif
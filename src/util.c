@@ -1,10 +1,19 @@
 #include <ctype.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "util.h"
 
-char token[MAXTOKEN];
-int tokenLength, tokenType, numToken;
+_Thread_local char token[MAXTOKEN];
+_Thread_local int tokenLength, tokenType, numToken;
+// where to jump to on an error instead of exiting, for anything that can
+// carry on without the roster it was reading. NULL means exit
+_Thread_local jmp_buf *errorHandler;
+
+static int countRanges(uint64_t *times);
+static int nextBitmapRange(uint64_t *p1Times, uint64_t *p2Times, int slot, int *startSlot, int *endSlot);
+static int nextListRange(Player *p1, Player *p2, int day, int slot, int *startSlot, int *endSlot);
+static int nextOwnRange(Player *player, int day, int slot, int *startSlot, int *endSlot);
 
 
 int numInArr(int *array, int length, int num)
@@ -34,15 +43,17 @@ int BSF(uint64_t num)
 	num = num & -num;
 
 	int count = 0;
-	if ((num & 0xffff0000) != 0)
+	if ((num & 0xffffffff00000000) != 0)
+		count += 32;
+	if ((num & 0xffff0000ffff0000) != 0)
 		count += 16;
-	if ((num & 0xff00ff00) != 0)
+	if ((num & 0xff00ff00ff00ff00) != 0)
 		count += 8;
-	if ((num & 0xf0f0f0f0) != 0)
+	if ((num & 0xf0f0f0f0f0f0f0f0) != 0)
 		count += 4;
-	if ((num & 0xcccccccc) != 0)
+	if ((num & 0xcccccccccccccccc) != 0)
 		count += 2;
-	if ((num & 0xaaaaaaaa) != 0)
+	if ((num & 0xaaaaaaaaaaaaaaaa) != 0)
 		count += 1;
 	return count;
 }
@@ -50,83 +61,281 @@ int BSF(uint64_t num)
 
 int PopCnt(uint64_t num)
 {
-	int count;
-	for (count = 0; num != 0; count++)
-		num &= num - 1;
-	return count;
+	// counts the bits in each pair, then each nibble, then each byte, then
+	// adds the bytes up
+	num = num - ((num >> 1) & 0x5555555555555555);
+	num = (num & 0x3333333333333333) + ((num >> 2) & 0x3333333333333333);
+	num = (num + (num >> 4)) & 0x0f0f0f0f0f0f0f0f;
+	return (num * 0x0101010101010101) >> 56;
 }
 
 
 int getNumTimeRanges(Player *player, int day)
+{
+	if (player->times == NULL)
+		return player->rangeStart[day + 1] - player->rangeStart[day];
+	return countRanges(player->times[day]);
+}
+
+
+static int countRanges(uint64_t *times)
 {
 	int total = 0;
-	for (int hour = 0; hour < 23; hour++) {
-		uint64_t time = player->times[day][hour];
-		total += (time & 1) + PopCnt(time ^ (time >> 1)) / 2;
+	// the last slot of the previous word, so a range crossing words isn't counted twice
+	uint64_t carry = 0;
+
+	for (int word = 0; word < WORDS_IN_DAY; word++) {
+		uint64_t time = times[word];
+		// every range starts with a 1 that has a 0 before it
+		total += PopCnt(time & ~(time << 1 | carry));
+		carry = time >> (WORD_BITS - 1);
 	}
 	return total;
 }
 
 
-void setMinuteBits(uint64_t times[DAYS_IN_WEEK][HOURS_IN_DAY], int day, int startHour, int endHour, int startMinute, int endMinute)
+void setSummaries(Player *player, uint64_t times[DAYS_IN_WEEK][WORDS_IN_DAY])
 {
-	if (startHour < endHour) {
-		// sets a row of bits from startMinute to MINUTES_IN_HOUR:
-		// - gets a row of 1's
-		// - left-shifts it by the difference in times
-		// - NOTs it to get a row of 1's from 0 to the difference
-		// - left-shifts it by startMinute to get a row of 1's from
-		//   startMinute to MINUTES_IN_HOUR
-		times[day][startHour] = ~(~(uint64_t)0 << (MINUTES_IN_HOUR - startMinute)) << startMinute;
+	player->dayMask = 0;
 
-		while (++startHour < endHour)
-			// row of 1's from 0 to MINUTES_IN_HOUR
-			times[day][startHour] = ~(~(uint64_t)0 << MINUTES_IN_HOUR);
+	for (int day = 0; day < DAYS_IN_WEEK; day++) {
+		player->hourMask[day] = 0;
+		for (int hour = 0; hour < HOURS_IN_DAY; hour++)
+			if (anySlotBits(times[day], hour * SLOTS_IN_HOUR, (hour + 1) * SLOTS_IN_HOUR))
+				player->hourMask[day] |= 1u << hour;
 
-		startMinute = 0;
+		if (player->hourMask[day] != 0)
+			player->dayMask |= 1u << day;
+		player->longestRun[day] = longestRunInDay(times[day]);
 	}
+}
+
+
+/* Most players only give a range or two a day, and for them a list of ranges
+ * is both smaller than the bitmap and quicker to intersect, so they get one of
+ * those instead. Everyone else keeps the bitmap.
+ */
+void setTimes(Player *player, uint64_t times[DAYS_IN_WEEK][WORDS_IN_DAY])
+{
+	int numRanges = 0, range = 0;
+
+	for (int day = 0; day < DAYS_IN_WEEK; day++)
+		numRanges += countRanges(times[day]);
 
-	times[day][endHour] = ~(~0 << (endMinute - startMinute)) << startMinute;
+	player->times = NULL;
+	player->ranges = NULL;
+	if (numRanges * sizeof(TimeRange) >= DAYS_IN_WEEK * WORDS_IN_DAY * sizeof(uint64_t)) {
+		player->times = malloc(DAYS_IN_WEEK * sizeof(*player->times));
+		memcpy(player->times, times, DAYS_IN_WEEK * sizeof(*player->times));
+		return;
+	}
+
+	player->ranges = malloc((numRanges + 1) * sizeof(TimeRange));
+	for (int day = 0; day < DAYS_IN_WEEK; day++) {
+		int start, end;
+
+		player->rangeStart[day] = range;
+		for (end = 0; nextBitmapRange(times[day], times[day], end, &start, &end); range++) {
+			player->ranges[range].start = start;
+			player->ranges[range].end = end;
+		}
+	}
+	player->rangeStart[DAYS_IN_WEEK] = range;
 }
 
 
-// returns 0 if unsuccessful, the range otherwise
-int getNextRange(uint64_t *p1Times, uint64_t *p2Times, float *startTime, float *endTime)
+// returns the longest unbroken run of the day, in minutes
+int longestRunInDay(uint64_t *times)
 {
-	// TODO:
-	// bits: 000010111111111001110111111111
-	// bits: 001111111110001101111111111000
-	// ^ get the length and start pos of each of
-	// the intersecting bits, one by one
+	int longest = 0;
+	// the run that's still going at the end of the previous word
+	int run = 0;
 
-	// TODO: this is outdated. Rewrite.
-	/*
-	uint64_t islands;
-	uint64_t boundaries;
-	uint64_t start;
-	uint64_t end;
+	for (int word = 0; word < WORDS_IN_DAY; word++) {
+		uint64_t time = times[word];
+		int length;
 
-	for (int hour = (int)*startTime; hour < HOURS_IN_DAY; hour++) {
-		if (!p1Times[hour] || !p2Times[hour])
+		if (time == ~(uint64_t)0) {
+			run += WORD_BITS;
 			continue;
-		islands = p1Times[hour] & p2Times[hour];
-		// TODO: implement a time range continuing from the previous hour
-		boundaries = islands ^ (islands << 1);
-		boundaries -= (start = BSF(boundaries));
-		boundaries -= (end = BSF(boundaries));
-		// if they're both non-0 (so both boundaries fit within 1 hour), that is one full range
-		if (start && end) {
-			*startTime = (float)hour + (float)getMagnitude(start) / 60.0;
-			*endTime += (float)hour + (float)getMagnitude(end) / 60.0;
-			return getMagnitude(end) - getMagnitude(start);
 		}
-		if (!start && end)
-			printError(UNREACHABLE_CODE);
-		if (start) {
-			*startTime += (float)getMagnitude(start) / 60.0;
+
+		// the 1's at the start of this word carry on the previous run
+		run += BSF(~time);
+		longest = MAX(longest, run);
+
+		// each iteration shortens every run of 1's by one, so the number
+		// of iterations is the length of the longest run
+		for (length = 0; time != 0; length++)
+			time &= time >> 1;
+		longest = MAX(longest, length);
+
+		// the 1's at the end of this word start a new run
+		for (run = 0; run < WORD_BITS
+				&& (times[word] >> (WORD_BITS - 1 - run) & 1); run++)
+			;
+	}
+
+	return MAX(longest, run) * SLOT_MINUTES;
+}
+
+
+// a row of 1's from bit start (inclusive) to bit end (exclusive) of one word
+static uint64_t slotMask(int start, int end)
+{
+	uint64_t mask = end >= WORD_BITS ? ~(uint64_t)0 : ~(~(uint64_t)0 << end);
+	return mask >> start << start;
+}
+
+
+void setMinuteBits(uint64_t times[DAYS_IN_WEEK][WORDS_IN_DAY], int day, int startHour, int endHour, int startMinute, int endMinute)
+{
+	// a slot is only available if every minute of it is, so the start
+	// is rounded up to the next slot and the end is rounded down
+	int start = startHour * MINUTES_IN_HOUR + startMinute;
+	int end = endHour * MINUTES_IN_HOUR + endMinute;
+
+	setSlotBits(times[day], (start + SLOT_MINUTES - 1) / SLOT_MINUTES,
+			MIN(end, MINUTES_IN_DAY) / SLOT_MINUTES);
+}
+
+
+// sets the slots from startSlot (inclusive) to endSlot (exclusive)
+void setSlotBits(uint64_t *times, int startSlot, int endSlot)
+{
+	for (int word = startSlot / WORD_BITS; startSlot < endSlot; word++) {
+		int wordEnd = MIN(endSlot, (word + 1) * WORD_BITS);
+		times[word] |= slotMask(startSlot % WORD_BITS, wordEnd - word * WORD_BITS);
+		startSlot = wordEnd;
+	}
+}
+
+
+// returns 1 if any slot from startSlot (inclusive) to endSlot (exclusive) is set
+int anySlotBits(uint64_t *times, int startSlot, int endSlot)
+{
+	for (int word = startSlot / WORD_BITS; startSlot < endSlot; word++) {
+		int wordEnd = MIN(endSlot, (word + 1) * WORD_BITS);
+		if (times[word] & slotMask(startSlot % WORD_BITS, wordEnd - word * WORD_BITS))
+			return 1;
+		startSlot = wordEnd;
+	}
+	return 0;
+}
+
+
+// Finds the next range of slots that both players are available for on the day,
+// starting from the end of the previous range (or midnight, if *endTime is 0).
+// Both times are in minutes since midnight.
+// returns 0 if unsuccessful, the length of the range in minutes otherwise
+int getNextRange(Player *p1, Player *p2, int day, int *startTime, int *endTime)
+{
+	int slot = (*endTime + SLOT_MINUTES - 1) / SLOT_MINUTES;
+	int start, end;
+
+	if (p1->times != NULL && p2->times != NULL) {
+		if (!nextBitmapRange(p1->times[day], p2->times[day], slot, &start, &end))
+			return 0;
+	} else if (p1->times == NULL && p2->times == NULL) {
+		if (!nextListRange(p1, p2, day, slot, &start, &end))
+			return 0;
+	} else {
+		// one of each: leapfrog the players' own ranges until they overlap
+		int start1, end1, start2, end2;
+		while (1) {
+			if (!nextOwnRange(p1, day, slot, &start1, &end1)
+					|| !nextOwnRange(p2, day, slot, &start2, &end2))
+				return 0;
+			start = MAX(start1, start2);
+			end = MIN(end1, end2);
+			if (start < end)
+				break;
+			slot = start;
+		}
+	}
+
+	*startTime = start * SLOT_MINUTES;
+	*endTime = end * SLOT_MINUTES;
+	return (end - start) * SLOT_MINUTES;
+}
+
+
+// the same as getNextRange, but for two bitmaps and in slots.
+// Returns 1 if there's a range, 0 otherwise
+static int nextBitmapRange(uint64_t *p1Times, uint64_t *p2Times, int slot, int *startSlot, int *endSlot)
+{
+	int word = slot / WORD_BITS, bit = slot % WORD_BITS;
+	int start = -1, end = SLOTS_IN_DAY;
+
+	// WORDS_IN_DAY is a constant, so for coarse slots this is only 1 or 2 iterations
+	for (; word < WORDS_IN_DAY; word++, bit = 0) {
+		uint64_t islands = (p1Times[word] & p2Times[word]) >> bit << bit;
+		uint64_t gaps;
+
+		if (start == -1) {
+			if (islands == 0)
+				continue;
+			bit = BSF(islands);
+			start = word * WORD_BITS + bit;
+		}
+
+		// the first slot at or after the start of the range that
+		// either player isn't available for is the end of the range
+		gaps = ~islands >> bit << bit;
+		if (gaps != 0) {
+			end = word * WORD_BITS + BSF(gaps);
+			break;
+		}
+	}
+
+	if (start == -1)
+		return 0;
+
+	*startSlot = start;
+	*endSlot = end;
+	return 1;
+}
+
+
+// the same as nextBitmapRange, but for two lists of ranges. Both lists are
+// sorted, so it's a merge: whichever range ends first can't overlap anything
+// after the other one, so it's the one that gets skipped
+static int nextListRange(Player *p1, Player *p2, int day, int slot, int *startSlot, int *endSlot)
+{
+	int i = p1->rangeStart[day], j = p2->rangeStart[day];
+
+	while (i < p1->rangeStart[day + 1] && j < p2->rangeStart[day + 1]) {
+		TimeRange *range1 = &p1->ranges[i], *range2 = &p2->ranges[j];
+		int start = MAX(slot, MAX(range1->start, range2->start));
+		int end = MIN(range1->end, range2->end);
+
+		if (start < end) {
+			*startSlot = start;
+			*endSlot = end;
+			return 1;
 		}
+		if (range1->end < range2->end)
+			i++;
+		else
+			j++;
 	}
-	*/
+	return 0;
+}
+
+
+// the range of slots the player is available for that's at or after slot,
+// cut short at slot if it started before it. Returns 1 if there is one
+static int nextOwnRange(Player *player, int day, int slot, int *startSlot, int *endSlot)
+{
+	if (player->times != NULL)
+		return nextBitmapRange(player->times[day], player->times[day], slot, startSlot, endSlot);
+
+	for (int i = player->rangeStart[day]; i < player->rangeStart[day + 1]; i++)
+		if (player->ranges[i].end > slot) {
+			*startSlot = MAX(slot, player->ranges[i].start);
+			*endSlot = player->ranges[i].end;
+			return 1;
+		}
 	return 0;
 }
 
@@ -198,55 +407,59 @@ void printError(int errorCode)
 	switch (errorCode) {
 		case EXPECTED_COLON:
 			fprintf(stderr, "ERROR %d: Expected colon\n", errorCode);
-			exit(errorCode);
+			break;
 
 		case EXPECTED_COMMA:
 			fprintf(stderr, "ERROR %d: Expected comma\n", errorCode);
-			exit(errorCode);
+			break;
 
 		case EXPECTED_CURLY_BRACKET:
 			fprintf(stderr, "ERROR %d: Expected curly bracket\n", errorCode);
-			exit(errorCode);
+			break;
 
 		case EXPECTED_DASH:
 			fprintf(stderr, "ERROR %d: Expected dash\n", errorCode);
-			exit(errorCode);
-			
+			break;
+
 		case EXPECTED_DECIMAL:
 			fprintf(stderr, "ERROR %d: Expected decimal\n", errorCode);
-			exit(errorCode);
-			
+			break;
+
 		case EXPECTED_DOT:
 			fprintf(stderr, "ERROR %d: Expected dot\n", errorCode);
-			exit(errorCode);
-			
+			break;
+
 		case EXPECTED_HALF:
 			fprintf(stderr, "ERROR %d: Expected .0 or .5\n", errorCode);
-			exit(errorCode);
-			
+			break;
+
 		case EXPECTED_NUMBER:
 			fprintf(stderr, "ERROR %d: Expected number\n", errorCode);
-			exit(errorCode);
-			
+			break;
+
 		case EXPECTED_SINGLE_DIGIT:
 			fprintf(stderr, "ERROR %d: Expected single digit\n", errorCode);
-			exit(errorCode);
-			
+			break;
+
 		case EXPECTED_STRING:
 			fprintf(stderr, "ERROR %d: Expected string\n", errorCode);
-			exit(errorCode);
+			break;
 
 		case TOO_MANY_DAYS:
 			fprintf(stderr, "ERROR %d: Too many days of the week given\n", errorCode);
-			exit(errorCode);
+			break;
 
 		case UNREACHABLE_CODE:
 			fprintf(stderr, "ERROR %d: Unreachable code", errorCode);
-			exit(errorCode);
+			break;
 
 		default:
 			fprintf(stderr, "Unknown error code \"%d\"\n", errorCode);
-			exit(errorCode);
+			break;
 	}
+
+	if (errorHandler != NULL)
+		longjmp(*errorHandler, errorCode);
+	exit(errorCode);
 }
 
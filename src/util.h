@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <setjmp.h>
 
 #include "misc.h"
 
@@ -16,12 +17,18 @@ int numLength(int num);
 int BSF(uint64_t num);
 int PopCnt(uint64_t num);
 int getNumTimeRanges(Player *player, int day);
-void setMinuteBits(uint64_t times[DAYS_IN_WEEK][HOURS_IN_DAY], int day, int startHour, int endHour, int startMinute, int endMinute);
-int getNextRange(uint64_t *p1times, uint64_t *p2Times, float *startTime, float *endTime);
+void setSummaries(Player *player, uint64_t times[DAYS_IN_WEEK][WORDS_IN_DAY]);
+void setTimes(Player *player, uint64_t times[DAYS_IN_WEEK][WORDS_IN_DAY]);
+int longestRunInDay(uint64_t *times);
+void setMinuteBits(uint64_t times[DAYS_IN_WEEK][WORDS_IN_DAY], int day, int startHour, int endHour, int startMinute, int endMinute);
+void setSlotBits(uint64_t *times, int startSlot, int endSlot);
+int anySlotBits(uint64_t *times, int startSlot, int endSlot);
+int getNextRange(Player *p1, Player *p2, int day, int *startTime, int *endTime);
 int getToken(FILE* file);
 void printError(int errorCode);
 
-extern char token[];
-extern int tokenLength, tokenType, numToken;
+extern _Thread_local char token[];
+extern _Thread_local int tokenLength, tokenType, numToken;
+extern _Thread_local jmp_buf *errorHandler;
 
 #endif
@@ -0,0 +1,517 @@
+/* Watch mode: the roster stays in memory and is republished every time the
+ * roster file is saved. Each line is hashed, and only the lines whose hash
+ * isn't already in the roster are parsed again; everyone else is carried
+ * over as-is, usually already in sorted order, so an edit to one player only
+ * costs the parsing of that line and moving it into place. Only the reading
+ * is incremental, though: every change pairs the whole roster again, from
+ * scratch, so the pairings are the same as a fresh run on the file would
+ * give. If a line can't be read, say because it's only half written, the
+ * roster's left as it was until the file's saved again.
+ * Every version of the roster is kept as a snapshot, and commands on stdin
+ * can go back to any of them, or try pairing the roster with other options.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/inotify.h>
+
+#include "files.h"
+#include "util.h"
+#include "pairing.h"
+#include "output.h"
+#include "snapshot.h"
+
+#define EVENT_BUFFER          4096
+#define COMMAND_LENGTH        256
+// the most words a command can have
+#define COMMAND_WORDS         32
+
+static char *readWholeFile(long *length);
+static void reloadPlayers(void);
+static int matchLines(char *contents, long length, int *newLine, long *newStart,
+		long *changedStart, long *changedLength, int *changedLine);
+static void refreshLines(void);
+static void republish(int isSaved);
+static void runCommand(char *command);
+static void tryOptions(char **words, int numWords);
+static void setLongest(void);
+static int parseLine(char *line, long length, long offset, int playerIdx);
+static int comparePlayers(const void *player1, const void *player2);
+static void mergePlayers(int middle);
+static double milliseconds(struct timespec start, struct timespec end);
+static uint64_t hashLine(char *line, long length);
+
+
+void watchPlayers()
+{
+	char events[EVENT_BUFFER] __attribute__((aligned(__alignof__(struct inotify_event))));
+	char command[COMMAND_LENGTH];
+	char *fileName = strrchr(playerFile, '/');
+	char *directory;
+	int watcher = inotify_init();
+	struct pollfd inputs[2];
+
+	// the directory is watched rather than the file, because most editors
+	// save by replacing the file instead of writing to it
+	if (fileName == NULL) {
+		directory = ".";
+		fileName = playerFile;
+	} else {
+		directory = strndup(playerFile, fileName - playerFile);
+		fileName++;
+	}
+	if (watcher == -1 || inotify_add_watch(watcher, directory, IN_CLOSE_WRITE | IN_MOVED_TO) == -1) {
+		fprintf(stderr, "ERROR: Couldn't watch \"%s\"\n", playerFile);
+		exit(1);
+	}
+
+	players = NULL;
+	totalPlayers = 0;
+	reloadPlayers();
+
+	inputs[0].fd = watcher;
+	inputs[1].fd = STDIN_FILENO;
+	inputs[0].events = inputs[1].events = POLLIN;
+	while (1) {
+		int isChanged = 0;
+		long length;
+
+		if (poll(inputs, 2, -1) <= 0)
+			break;
+		if (inputs[1].revents != 0) {
+			if (fgets(command, sizeof(command), stdin) != NULL)
+				runCommand(command);
+			else
+				// poll skips negative descriptors, so this stops it watching stdin
+				inputs[1].fd = -1;
+		}
+		if (inputs[0].revents == 0)
+			continue;
+
+		length = read(watcher, events, sizeof(events));
+		if (length <= 0)
+			break;
+		for (char *event = events; event < events + length;
+				event += sizeof(struct inotify_event) + ((struct inotify_event *)event)->len) {
+			struct inotify_event *info = (struct inotify_event *)event;
+			if (info->len != 0 && !strcmp(info->name, fileName))
+				isChanged = 1;
+		}
+		if (isChanged)
+			reloadPlayers();
+	}
+
+	exit(0);
+}
+
+
+static char *readWholeFile(long *length)
+{
+	FILE *file = fopen(playerFile, "r");
+	char *contents;
+
+	if (file == NULL) {
+		fprintf(stderr, "ERROR: Couldn't open \"%s\"\n", playerFile);
+		*length = 0;
+		return NULL;
+	}
+	fseek(file, 0, SEEK_END);
+	*length = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	contents = malloc(*length + 1);
+	*length = fread(contents, 1, *length, file);
+	contents[*length] = '\0';
+	fclose(file);
+
+	return contents;
+}
+
+
+static void reloadPlayers()
+{
+	long length;
+	char *contents = readWholeFile(&length);
+	Player *oldPlayers = players;
+	int oldTotal = totalPlayers;
+	// the line each old player is on now, or -1 if their line is gone, and
+	// where that line starts now
+	int *newLine = malloc((oldTotal + 1) * sizeof(int));
+	long *newStart = malloc((oldTotal + 1) * sizeof(long));
+	// the lines that need to be parsed again
+	long *changedStart, *changedLength;
+	int *changedLine;
+	int numChanged = 0, numLines = 0, numParsed = 0, numKept = 0, isBroken = 0;
+	struct timespec start, parsed, end;
+
+	if (contents == NULL) {
+		free(newLine);
+		free(newStart);
+		return;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (long i = 0; i < length; i++)
+		numLines += contents[i] == '\n';
+	changedStart = malloc((numLines + 1) * sizeof(long));
+	changedLength = malloc((numLines + 1) * sizeof(long));
+	changedLine = malloc((numLines + 1) * sizeof(int));
+	numChanged = matchLines(contents, length, newLine, newStart, changedStart, changedLength, changedLine);
+
+	// the changed lines are parsed first, so if one of them is broken (say
+	// it's only half written), the roster can be left as it was
+	for (int i = 0; i < oldTotal; i++)
+		numKept += newLine[i] != -1;
+	players = malloc((oldTotal + numChanged + 1) * sizeof(Player));
+	for (int i = 0; i < numChanged && !isBroken; i++) {
+		int result = parseLine(contents + changedStart[i], changedLength[i], changedStart[i], numKept + numParsed);
+
+		if (result == -1) {
+			fprintf(stderr, "Couldn't read line %d of \"%s\", so the roster's been left as it was\n",
+					changedLine[i] + 1, playerFile);
+			isBroken = 1;
+		} else if (result == 1) {
+			players[numKept + numParsed++].line = changedLine[i];
+		}
+	}
+
+	if (isBroken) {
+		for (int i = numKept; i < numKept + numParsed; i++)
+			freePlayer(&players[i]);
+		free(players);
+		players = oldPlayers;
+		setLongest();
+	} else {
+		// the players that are carried over stay in their old (sorted) order,
+		// unless lines have been moved around
+		totalPlayers = 0;
+		for (int i = 0; i < oldTotal; i++) {
+			if (newLine[i] == -1) {
+				freePlayer(&oldPlayers[i]);
+				continue;
+			}
+			players[totalPlayers] = oldPlayers[i];
+			players[totalPlayers].line = newLine[i];
+			// their comment moves along with their line, if anything's been
+			// added or taken out above it
+			players[totalPlayers].commentOffset += newStart[i] - oldPlayers[i].lineStart;
+			players[totalPlayers++].lineStart = newStart[i];
+		}
+		totalPlayers += numParsed;
+
+		// players with the same score go in the order of their lines, so if
+		// any have swapped places, everyone carried over is sorted again.
+		// Otherwise only the changed players need sorting before the two
+		// are merged together
+		for (int i = 1; i < numKept; i++)
+			if (comparePlayers(&players[i - 1], &players[i]) > 0) {
+				qsort(players, numKept, sizeof(Player), comparePlayers);
+				break;
+			}
+		qsort(players + numKept, numParsed, sizeof(Player), comparePlayers);
+		mergePlayers(numKept);
+		clock_gettime(CLOCK_MONOTONIC, &parsed);
+
+		setLongest();
+		republish(1);
+		// the snapshot copies the players' comments, which aren't kept in low memory mode
+		if (!isLowMemory)
+			takeSnapshot("saved");
+
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		fprintf(stderr, "Reparsed %d of %d players in %.2f ms, then paired them in %.2f ms\n",
+				numParsed, totalPlayers, milliseconds(start, parsed), milliseconds(parsed, end));
+		free(oldPlayers);
+	}
+	free(contents);
+	free(newLine);
+	free(newStart);
+	free(changedStart);
+	free(changedLength);
+	free(changedLine);
+}
+
+
+// matches each line of the file to a player in the roster with the same hash,
+// if there is one. newLine and newStart are set to the line each player's on
+// now and where it starts, or -1 if their line's gone. If changedStart isn't
+// NULL, the lines that didn't match anyone are listed in the changed arrays.
+// Returns how many lines didn't match
+static int matchLines(char *contents, long length, int *newLine, long *newStart,
+		long *changedStart, long *changedLength, int *changedLine)
+{
+	// a table of the players' line hashes, holding an index into players + 1
+	int tableSize = 16, numChanged = 0;
+	int *table;
+
+	while (tableSize < 2 * totalPlayers)
+		tableSize *= 2;
+	table = calloc(tableSize, sizeof(int));
+	for (int i = 0; i < totalPlayers; i++) {
+		int slot = players[i].lineHash & (tableSize - 1);
+		while (table[slot] != 0)
+			slot = (slot + 1) & (tableSize - 1);
+		table[slot] = i + 1;
+		newLine[i] = -1;
+	}
+
+	for (long lineStart = 0, line = 0; lineStart < length; line++) {
+		char *lineEnd = memchr(contents + lineStart, '\n', length - lineStart);
+		long lineLength = (lineEnd == NULL ? contents + length : lineEnd) - (contents + lineStart);
+		uint64_t hash = hashLine(contents + lineStart, lineLength);
+		int slot = hash & (tableSize - 1), isFound = 0;
+
+		for (; table[slot] != 0; slot = (slot + 1) & (tableSize - 1)) {
+			int player = table[slot] - 1;
+			if (players[player].lineHash == hash && newLine[player] == -1) {
+				newLine[player] = line;
+				newStart[player] = lineStart;
+				isFound = 1;
+				break;
+			}
+		}
+		if (!isFound && changedStart != NULL) {
+			changedStart[numChanged] = lineStart;
+			changedLength[numChanged] = lineLength;
+			changedLine[numChanged] = line;
+		}
+		numChanged += !isFound;
+		lineStart += lineLength + 1;
+	}
+
+	free(table);
+	return numChanged;
+}
+
+
+// a snapshot's players are saved by their lines alone, so they come back
+// with whichever line numbers they had when they were first saved. Anyone
+// whose line is still in the file is put back on it
+static void refreshLines()
+{
+	long length;
+	char *contents = readWholeFile(&length);
+	int *newLine;
+	long *newStart;
+
+	if (contents == NULL)
+		return;
+	newLine = malloc((totalPlayers + 1) * sizeof(int));
+	newStart = malloc((totalPlayers + 1) * sizeof(long));
+	matchLines(contents, length, newLine, newStart, NULL, NULL, NULL);
+	for (int i = 0; i < totalPlayers; i++) {
+		if (newLine[i] == -1)
+			continue;
+		players[i].commentOffset += newStart[i] - players[i].lineStart;
+		players[i].lineStart = newStart[i];
+		players[i].line = newLine[i];
+	}
+
+	free(contents);
+	free(newLine);
+	free(newStart);
+}
+
+
+// pairs the roster and prints the pairings. Only saved pairings are written
+// to the updated roster; the others are just to look at
+static void republish(int isSaved)
+{
+	// pairing adds this round's opponents to everyone's history, which
+	// mustn't stick around for the next time the roster changes
+	int *prevPlayedNum = malloc((totalPlayers + 1) * sizeof(int));
+
+	for (int i = 0; i < totalPlayers; i++) {
+		prevPlayedNum[i] = players[i].prevPlayedNum;
+		players[i].paired = 0;
+	}
+	if (totalPlayers > 0 && isSaved) {
+		publishPairings();
+	} else if (totalPlayers > 0) {
+		beginOutput();
+		printPlayers();
+		pairPlayers();
+		endOutput();
+	}
+	for (int i = 0; i < totalPlayers; i++) {
+		players[i].prevPlayedNum = prevPlayedNum[i];
+		players[i].paired = 0;
+	}
+	free(prevPlayedNum);
+}
+
+
+/* The commands are:
+ * - "list": lists the snapshots
+ * - "back <id>": goes back to a snapshot, and pairs it again
+ * - "try <options>": pairs the roster with other -d, -p, -t, -e or -m
+ *   options, without saving the pairings. The result is kept as a snapshot,
+ *   so it can be gone back to
+ */
+static void runCommand(char *command)
+{
+	char *words[COMMAND_WORDS];
+	int numWords = 0, id;
+
+	for (char *word = strtok(command, " \t\n"); word != NULL && numWords < COMMAND_WORDS;
+			word = strtok(NULL, " \t\n"))
+		words[numWords++] = word;
+	if (numWords == 0)
+		return;
+
+	if (isLowMemory) {
+		fprintf(stderr, "Snapshots need the comments kept in memory, so they're off in low memory mode\n");
+	} else if (!strcmp(words[0], "list")) {
+		listSnapshots();
+	} else if (!strcmp(words[0], "back") && numWords == 2 && sscanf(words[1], "%d", &id) == 1) {
+		if (!restoreSnapshot(id)) {
+			fprintf(stderr, "There's no snapshot %d. Only the last %d are kept\n", id, MAX_SNAPSHOTS);
+			return;
+		}
+		refreshLines();
+		setLongest();
+		republish(1);
+		fprintf(stderr, "Went back to snapshot %d\n", id);
+	} else if (!strcmp(words[0], "try")) {
+		tryOptions(words + 1, numWords - 1);
+	} else {
+		fprintf(stderr, "Commands: list, back <snapshot>, try <options>\n");
+	}
+}
+
+
+static void tryOptions(char **words, int numWords)
+{
+	int oldPointDif = maxPointDif, oldTimeDif = minTimeDif, oldEarliest = earliestTime;
+	int oldDay = dayOfWeek, oldMode = pairingMode, parent = currentSnapshot;
+	char label[SNAPSHOT_LABEL] = "try";
+	float number;
+
+	// anything else would change more than how this roster's paired, and
+	// the values are checked here, since handleArg exits on a bad one
+	for (int i = 0; i < numWords; i += 2)
+		if (words[i][0] != '-' || words[i][1] == '\0' || words[i][2] != '\0'
+				|| strchr("dptem", words[i][1]) == NULL || i + 1 == numWords
+				|| (words[i][1] == 'd' && parseDay(words[i + 1]) == -1)
+				|| (words[i][1] == 'm' && parseMode(words[i + 1]) == -1)
+				|| (strchr("pte", words[i][1]) != NULL && sscanf(words[i + 1], "%f", &number) != 1)) {
+			fprintf(stderr, "Usage: try [-d <day, 0 to 6>] [-p <points>] [-t <minutes>] [-e <hour>]\n"
+					"           [-m greedy, dutch or constrained]\n");
+			return;
+		}
+	for (int i = 0; i < numWords; i += 2) {
+		handleArg(words[i], words[i + 1]);
+		snprintf(label + strlen(label), SNAPSHOT_LABEL - strlen(label), " %s %s", words[i], words[i + 1]);
+	}
+
+	republish(0);
+	// it's the same roster, so the snapshot shares everything with the current
+	// one, which stays current
+	takeSnapshot(label);
+	fprintf(stderr, "Kept as snapshot %d\n", currentSnapshot);
+	currentSnapshot = parent;
+
+	maxPointDif = oldPointDif;
+	minTimeDif = oldTimeDif;
+	earliestTime = oldEarliest;
+	dayOfWeek = oldDay;
+	pairingMode = oldMode;
+}
+
+
+static void setLongest()
+{
+	longestName = 0;
+	for (int i = 0; i < totalPlayers; i++)
+		longestName = MAX(longestName, (int)strlen(players[i].name) + 1);
+	longestPlayerID = numLength(totalPlayers - 1);
+}
+
+
+// parses one line of the roster into players[playerIdx]. Returns 1 if the
+// line was a player; 0 if it was blank or a comment; -1 if it couldn't be read
+static int parseLine(char *line, long length, long offset, int playerIdx)
+{
+	jmp_buf handler;
+
+	if (length == 0)
+		return 0;
+
+	fp = fmemopen(line, length, "r");
+	if (getToken(fp) == HASHTAG || tokenType == EOF) {
+		fclose(fp);
+		return 0;
+	}
+	// anything it gets to before the error is freed along with it
+	memset(&players[playerIdx], 0, sizeof(Player));
+	if (setjmp(handler) != 0) {
+		errorHandler = NULL;
+		fclose(fp);
+		freePlayer(&players[playerIdx]);
+		return -1;
+	}
+	errorHandler = &handler;
+	readPlayer(playerIdx);
+	errorHandler = NULL;
+	fclose(fp);
+
+	players[playerIdx].lineHash = hashLine(line, length);
+	players[playerIdx].lineStart = offset;
+	// the comment is somewhere in this line, not at the start of the file
+	players[playerIdx].commentOffset += offset;
+	return 1;
+}
+
+
+// the same order as sortPlayers: highest score first, then the order of the file
+static int comparePlayers(const void *player1, const void *player2)
+{
+	const Player *p1 = player1, *p2 = player2;
+
+	if (p1->score != p2->score)
+		return p2->score - p1->score;
+	return p1->line - p2->line;
+}
+
+
+// merges the sorted players before middle with the sorted players after it
+static void mergePlayers(int middle)
+{
+	Player *merged;
+	int left = 0, right = middle;
+
+	if (middle == 0 || middle == totalPlayers)
+		return;
+
+	merged = malloc(totalPlayers * sizeof(Player));
+	for (int i = 0; i < totalPlayers; i++)
+		if (right == totalPlayers || (left < middle
+					&& comparePlayers(&players[left], &players[right]) <= 0))
+			merged[i] = players[left++];
+		else
+			merged[i] = players[right++];
+	free(players);
+	players = merged;
+}
+
+
+static double milliseconds(struct timespec start, struct timespec end)
+{
+	return (end.tv_sec - start.tv_sec) * 1000.0 + (end.tv_nsec - start.tv_nsec) / 1000000.0;
+}
+
+
+// FNV-1a
+static uint64_t hashLine(char *line, long length)
+{
+	uint64_t hash = 0xcbf29ce484222325;
+
+	for (long i = 0; i < length; i++) {
+		hash ^= (unsigned char)line[i];
+		hash *= 0x100000001b3;
+	}
+	return hash;
+}
@@ -1,15 +1,25 @@
 #include <stdio.h>
+#include <sys/types.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
 
 #include "misc.h"
 #include "files.h"
 #include "util.h"
+#include "trace.h"
+
+_Thread_local char *updatedPlayerFile = "newPlayerList.txt";
 
 
 void updateFile()
 {
+	TRACE_SCOPE("updateFile");
 	int mostPairedPlayers = 0;
 	int numTimeRanges = 0;
-	FILE *updatedPlayers = fopen("newPlayerList.txt", "w+");
+	FILE *updatedPlayers = fopen(updatedPlayerFile, "w+");
+	// in low memory mode, the comments are copied straight from here
+	FILE *playerList = isLowMemory ? fopen(playerFile, "r") : NULL;
 
 	// this is to align nicely the data entries that come
 	// after the previously paired players list
@@ -21,10 +31,14 @@ void updateFile()
 			numTimeRanges = playerTimeRanges;
 	}
 
-	for (int i = 0; i < totalPlayers; i++)
+	for (int i = 0; i < totalPlayers; i++) {
 		writeLine(updatedPlayers, &players[i], mostPairedPlayers, numTimeRanges);
+		writeComment(updatedPlayers, playerList, &players[i]);
+	}
 
 	fclose(updatedPlayers);
+	if (playerList != NULL)
+		fclose(playerList);
 }
 
 
@@ -36,9 +50,8 @@ void writeLine(FILE *updatedPlayers, Player *player, int mostPairedPlayers, int
 	fprintf(updatedPlayers, "%-3d %*s", player->id, -longestName, player->name);
 	spaces = writePrevPairedIDs(updatedPlayers, player, mostPairedPlayers);
 	// player score
-	fprintf(updatedPlayers, "%*.1f", spaces, player->score);
+	fprintf(updatedPlayers, "%*d.%c", spaces - 2, player->score / 2, player->score % 2 ? '5' : '0');
 	writeAllTimes(updatedPlayers, player, mostTimeRanges);
-	fprintf(updatedPlayers, "   %s\n", player->comment);
 }
 
 
@@ -52,7 +65,7 @@ int writePrevPairedIDs(FILE *updatedPlayers, Player *player, int mostPairedPlaye
 	for (int i = 0; i < player->prevPlayedNum; i++) {
 		currentPairedPlayers++;
 		fprintf(updatedPlayers, "%*d", -longestPlayerID, player->prevPlayed[i]);
-		if (i != players[i].prevPlayedNum - 1)
+		if (i != player->prevPlayedNum - 1)
 			fprintf(updatedPlayers, ", ");
 	}
 	spaces = (mostPairedPlayers - currentPairedPlayers) * longestPlayerID;
@@ -71,17 +84,55 @@ int writePrevPairedIDs(FILE *updatedPlayers, Player *player, int mostPairedPlaye
 
 void writeAllTimes(FILE *updatedPlayers, Player *player, int mostTimeRanges)
 {
-	// TODO: make this print the times properly
 	fprintf(updatedPlayers, "    {");
 	for (int i = 0; i < DAYS_IN_WEEK; i++) {
-		fprintf(updatedPlayers, " {");
-		for (int j = 0; j < HOURS_IN_DAY; j++) {
-			for (int k = 0; k < MINUTES_IN_HOUR; k++) {
-			}
+		int startTime = 0, endTime = 0;
+		int count = 0;
 
-		}
+		fprintf(updatedPlayers, " {");
+		// the ranges a player is available for are the ones they share with themselves
+		while (getNextRange(player, player, i, &startTime, &endTime))
+			fprintf(updatedPlayers, "%s%d:%02d-%d:%02d", count++ == 0 ? "" : ", ",
+					startTime / MINUTES_IN_HOUR, startTime % MINUTES_IN_HOUR,
+					endTime / MINUTES_IN_HOUR, endTime % MINUTES_IN_HOUR);
 		fprintf(updatedPlayers, "}");
-		if (i != DAYS_IN_WEEK - 1)
-			fprintf(updatedPlayers, ",");
 	}
+	fprintf(updatedPlayers, " }");
+}
+
+
+void writeComment(FILE *updatedPlayers, FILE *playerList, Player *player)
+{
+	off_t offset = player->commentOffset;
+	size_t remaining = player->commentLength;
+	char buffer[BUFSIZ];
+	size_t length;
+
+	fprintf(updatedPlayers, "   ");
+	if (player->comment != NULL || playerList == NULL) {
+		fprintf(updatedPlayers, "%s\n", player->comment != NULL ? player->comment : "");
+		return;
+	}
+
+	// everything before the comment has to be in the file before it's
+	// spliced in underneath the buffer
+	fflush(updatedPlayers);
+#ifdef __linux__
+	while (remaining > 0) {
+		ssize_t sent = sendfile(fileno(updatedPlayers), fileno(playerList), &offset, remaining);
+		if (sent <= 0)
+			break;
+		remaining -= sent;
+	}
+	// the splice moved the file on without the stream knowing about it
+	fseek(updatedPlayers, 0, SEEK_END);
+#endif
+	// if the file can't be spliced (or this isn't Linux), copy it by hand
+	fseek(playerList, offset, SEEK_SET);
+	while (remaining > 0
+			&& (length = fread(buffer, 1, MIN(remaining, sizeof(buffer)), playerList)) > 0) {
+		fwrite(buffer, 1, length, updatedPlayers);
+		remaining -= length;
+	}
+	fprintf(updatedPlayers, "\n");
 }